@@ -0,0 +1,4 @@
+Import("env")
+
+# build_src_flagsはリンクには渡らないため，LTOをリンクでも有効にする
+env.Append(LINKFLAGS=["-flto", "-O2"])
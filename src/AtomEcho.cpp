@@ -1,5 +1,11 @@
 #include "AtomEcho.hpp"
 
+#include "HeapGuard.hpp"
+
+#if defined(HEAP_GUARD) && defined(ENABLE_MIC_TRIGGER)
+#warning "HEAP_GUARD with ENABLE_MIC_TRIGGER: every playback reinstalls I2S"
+#endif
+
 // https://github.com/m5stack/M5Unified/blob/master/examples/Advanced/Speaker_SD_wav_file/Speaker_SD_wav_file.ino
 
 static constexpr const size_t WAV_N_BUFS = 3;
@@ -27,17 +33,44 @@ struct __attribute__((packed)) sub_chunk_t
     uint8_t data[1];
 };
 
-AtomEcho::AtomEcho(void) : _brightness(255) {
+AtomEcho::AtomEcho(void)
+    : _brightness(255),
+      _i2sLock(nullptr),
+      _stopGeneration(0),
+      _wavFile(),
+      _wavFs(nullptr),
+      _wavFilename(nullptr),
+      _wavDataOffset(0),
+      _wavDataLength(0),
+      _wavSampleRate(0),
+      _wavStereo(false),
+      _wav16bit(false) {
 }
 
 AtomEcho::~AtomEcho(void) {
+    if (this->_wavFile) {
+        this->_wavFile.close();
+    }
+    if (this->_i2sLock != nullptr) {
+        vSemaphoreDelete(this->_i2sLock);
+        this->_i2sLock = nullptr;
+    }
 }
 
 void AtomEcho::begin(void) {
     auto cfg = M5.config();
     cfg.internal_mic = true;
     cfg.internal_spk = true;
+    // Atom EchoにはIMUもRTCもない。I2Cで探させないことで，M5.begin()が
+    // 並行して初期化しているセンサーのバス（Wire）に触らないようにする
+    cfg.internal_imu = false;
+    cfg.internal_rtc = false;
+    cfg.external_imu = false;
+    cfg.external_rtc = false;
     M5.begin(cfg);
+    if (this->_i2sLock == nullptr) {
+        this->_i2sLock = xSemaphoreCreateMutex();
+    }
 }
 
 void AtomEcho::update(void) {
@@ -56,13 +89,110 @@ void AtomEcho::setVolume(uint8_t v) {
     M5.Speaker.setVolume(v);
 }
 
-bool AtomEcho::playWav(FS& fs, const char* filename) {
+bool AtomEcho::playWav(FS& fs, const char* filename, uint32_t timeout) {
+    return playWav(fs, filename, timeout, getStopGeneration());
+}
+
+bool AtomEcho::playWav(FS& fs, const char* filename, uint32_t timeout,
+                       uint32_t generation) {
+    const uint32_t start = millis();
+    const TickType_t wait =
+        timeout == NO_TIMEOUT ? portMAX_DELAY : pdMS_TO_TICKS(timeout);
+    if (this->_i2sLock == nullptr ||
+        xSemaphoreTake(this->_i2sLock, wait) != pdTRUE) {
+        ESP_LOGE("AtomEcho", "I2S is not available");
+        return false;
+    }
+    if (generation != this->_stopGeneration) {
+        // 再生を始める前に止められた
+        xSemaphoreGive(this->_i2sLock);
+        return true;
+    }
+    switchToSpeaker();
+    if (filename == nullptr || this->_wavFs != &fs ||
+        this->_wavFilename == nullptr ||
+        strcmp(this->_wavFilename, filename) != 0) {
+        if (!openWav(fs, filename)) {
+            xSemaphoreGive(this->_i2sLock);
+            return false;
+        }
+    }
+    const bool result = playWavFile(generation, start, timeout);
+    xSemaphoreGive(this->_i2sLock);
+    return result;
+}
+
+void AtomEcho::stopWav(void) {
+    ++(this->_stopGeneration);
+    if (M5.Speaker.isEnabled()) {
+        M5.Speaker.stop();
+    }
+}
+
+bool AtomEcho::isPlaying(void) const {
+    return M5.Speaker.isEnabled() && M5.Speaker.isPlaying();
+}
+
+bool AtomEcho::useSpeaker(void) {
+    if (this->_i2sLock == nullptr ||
+        xSemaphoreTake(this->_i2sLock, portMAX_DELAY) != pdTRUE) {
+        return false;
+    }
+    const bool result = switchToSpeaker();
+    xSemaphoreGive(this->_i2sLock);
+    return result;
+}
+
+bool AtomEcho::listen(void) {
+    if (M5.Mic.isEnabled()) {
+        return true;
+    }
+    if (this->_i2sLock == nullptr ||
+        xSemaphoreTake(this->_i2sLock, 0) != pdTRUE) {
+        return false;
+    }
+    bool result = false;
+    if (!isPlaying()) {
+        result = switchToMic();
+    }
+    xSemaphoreGive(this->_i2sLock);
+    return result;
+}
+
+bool AtomEcho::isListening(void) const {
+    return M5.Mic.isEnabled();
+}
+
+bool AtomEcho::record(int16_t* buf, size_t len, uint32_t rate) {
+    if (this->_i2sLock == nullptr ||
+        xSemaphoreTake(this->_i2sLock, 0) != pdTRUE) {
+        return false;
+    }
+    const bool result = M5.Mic.isEnabled() && M5.Mic.record(buf, len, rate);
+    xSemaphoreGive(this->_i2sLock);
+    return result;
+}
+
+size_t AtomEcho::getRecordingCount(void) const {
+    return M5.Mic.isRecording();
+}
+
+bool AtomEcho::openWav(FS& fs, const char* filename) {
+    if (this->_wavFile) {
+        this->_wavFile.close();
+    }
+    this->_wavFs = nullptr;
+    this->_wavFilename = nullptr;
     if (filename == nullptr || !fs.exists(filename)) {
         ESP_LOGE("AtomEcho", "WAV File is not found");
         return false;
     }
-    ESP_LOGD("AtomEcho", "Playing WAV file: %s", filename);
+    ESP_LOGD("AtomEcho", "Opening WAV file: %s", filename);
     File file = fs.open(filename);
+    if (!file) {
+        ESP_LOGE("AtomEcho", "Failed to open %s", filename);
+        return false;
+    }
 
     wav_header_t header;
     file.read((uint8_t*)&header, sizeof(wav_header_t));
@@ -108,28 +238,84 @@ bool AtomEcho::playWav(FS& fs, const char* filename) {
         return false;
     }
 
-    int32_t data_len = sub_chunk.chunk_size;
-    bool flg_16bit = (header.bit_per_sample >> 4);
+    this->_wavFile = file;
+    this->_wavFs = &fs;
+    this->_wavFilename = filename;
+    this->_wavDataOffset = file.position();
+    this->_wavDataLength = sub_chunk.chunk_size;
+    this->_wavSampleRate = header.sample_rate;
+    this->_wavStereo = header.channel > 1;
+    this->_wav16bit = (header.bit_per_sample >> 4);
+    return true;
+}
+
+bool AtomEcho::playWavFile(uint32_t generation, uint32_t start,
+                           uint32_t timeout) {
+    // 開いたままのファイルを先頭に戻して使うため，ヒープを確保しない
+    if (!this->_wavFile.seek(this->_wavDataOffset)) {
+        ESP_LOGE("AtomEcho", "Failed to seek WAV file");
+        return false;
+    }
+    ESP_LOGD("AtomEcho", "Playing WAV file: %s", this->_wavFilename);
+    int32_t data_len = this->_wavDataLength;
 
     size_t idx = 0;
-    while (data_len > 0) {
+    // stopWav()が呼ばれたら残りを送らずに止める
+    while (data_len > 0 && generation == this->_stopGeneration) {
         size_t len = data_len < WAV_BUF_SIZE ? data_len : WAV_BUF_SIZE;
-        len = file.read(wav_data[idx], len);
+        len = this->_wavFile.read(wav_data[idx], len);
+        if (len == 0) {
+            break;
+        }
         data_len -= len;
 
-        if (flg_16bit) {
+        if (this->_wav16bit) {
             M5.Speaker.playRaw((const int16_t*)wav_data[idx], len >> 1,
-                               header.sample_rate, header.channel > 1, 1, 0);
+                               this->_wavSampleRate, this->_wavStereo, 1, 0);
         } else {
             M5.Speaker.playRaw((const uint8_t*)wav_data[idx], len,
-                               header.sample_rate, header.channel > 1, 1, 0);
+                               this->_wavSampleRate, this->_wavStereo, 1, 0);
         }
         idx = idx < (WAV_N_BUFS - 1) ? idx + 1 : 0;
+        if (timeout != NO_TIMEOUT && millis() - start >= timeout) {
+            // 持ち時間を使い切った。キューに残っている分も止める
+            ESP_LOGW("AtomEcho", "Playback timed out: %dms", timeout);
+            M5.Speaker.stop();
+            break;
+        }
     }
-    file.close();
     return true;
 }
 
+bool AtomEcho::switchToSpeaker(void) {
+    if (M5.Speaker.isEnabled() && !M5.Mic.isEnabled()) {
+        return true;
+    }
+    // マイクとスピーカーはI2Sを共有しているため，再生中はマイクを止める。
+    // ドライバーの入れ直しとM5Unifiedのタスクの作り直しでヒープを確保するが，
+    // heap_caps_malloc()で直接確保するため数えられない
+#if defined(HEAP_GUARD)
+    HeapGuard::recordUncounted("I2S switched to speaker");
+#endif
+    if (M5.Mic.isEnabled()) {
+        M5.Mic.end();
+    }
+    return M5.Speaker.begin();
+}
+
+bool AtomEcho::switchToMic(void) {
+    if (M5.Mic.isEnabled() && !M5.Speaker.isEnabled()) {
+        return true;
+    }
+#if defined(HEAP_GUARD)
+    HeapGuard::recordUncounted("I2S switched to mic");
+#endif
+    if (M5.Speaker.isEnabled()) {
+        M5.Speaker.end();
+    }
+    return M5.Mic.begin();
+}
+
 void AtomEcho::showLED(const led_color_t& color) const {
     showLED(color.R, color.G, color.B);
 }
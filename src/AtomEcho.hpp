@@ -3,6 +3,9 @@
 #include <FS.h>
 #include <M5Unified.h>
 #include <esp_log.h>
+#include <freertos/semphr.h>
+
+#include <atomic>
 
 class AtomEcho {
 public:
@@ -22,6 +25,8 @@ public:
     static constexpr int SCL_PIN = GPIO_NUM_32;
     /* RGB LEDピン番号 */
     static constexpr int RGB_LED_PIN = GPIO_NUM_27;
+    /* 再生にかける時間を制限しない */
+    static constexpr uint32_t NO_TIMEOUT = UINT32_MAX;
 
     /*
      * コンストラクタ
@@ -66,13 +71,116 @@ public:
      */
     virtual void setVolume(uint8_t v);
 
+    /*
+     * WAVファイルを開いてヘッダーを読み込みます。
+     * 開いたファイルは閉じずに再生に使うため，再生のたびにファイルを開いて
+     * ヒープを確保することがなくなります。再生していないときに呼ぶこと
+     *
+     * @param fs ファイルが置いてあるファイルシステム
+     * @param filename WAVファイル名。開いている間は有効な文字列であること
+     * @retval true 開けた
+     * @retval false ファイルがない，もしくは再生できないWAVファイル
+     */
+    virtual bool openWav(FS& fs, const char* filename);
+
+    /*
+     * WAVファイルを再生します。
+     * openWav()で開いたファイルと違う場合は開き直します。
+     * 時間切れになったら，I2Sを待っている場合は再生せず，再生中の場合は
+     * 残りを送らずにスピーカーを止めます。
+     *
+     * @param fs ファイルが置いてあるファイルシステム
+     * @param filename 再生するWAVファイル名
+     * @param timeout 再生にかけてよい時間（ミリ秒）。I2Sを待つ時間を含む
+     * @retval true 再生した（時間切れで途中で止めた場合を含む）
+     * @retval false 再生できなかった
+     */
+    virtual bool playWav(FS& fs, const char* filename,
+                         uint32_t timeout = NO_TIMEOUT);
+
     /*
      * WAVファイルを再生します。
+     * 再生を決める前にgetStopGeneration()で取った値を渡すと，それ以降に
+     * stopWav()が呼ばれていた場合は再生しません。
      *
      * @param fs ファイルが置いてあるファイルシステム
      * @param filename 再生するWAVファイル名
+     * @param timeout 再生にかけてよい時間（ミリ秒）。I2Sを待つ時間を含む
+     * @param generation getStopGeneration()で取った値
+     * @retval true 再生した（止められた場合を含む）
+     * @retval false 再生できなかった
+     */
+    virtual bool playWav(FS& fs, const char* filename, uint32_t timeout,
+                         uint32_t generation);
+
+    /*
+     * 再生中のWAVファイルを止めます。ほかのタスクから呼べます。
+     * 再生を始める前に呼んだ場合も，それより前に取った
+     * getStopGeneration()の値で再生しようとしたものは止まります。
+     */
+    virtual void stopWav(void);
+
+    /*
+     * stopWav()を呼んだ回数を返します。
+     *
+     * @return stopWav()を呼んだ回数
+     */
+    inline uint32_t getStopGeneration(void) const {
+        return this->_stopGeneration.load();
+    }
+
+    /*
+     * スピーカーで再生中かを返します。
+     *
+     * @retval true 再生中
+     * @retval false 再生していない
+     */
+    virtual bool isPlaying(void) const;
+
+    /*
+     * I2Sをスピーカーに切り替えておきます。
+     * マイクを使わない場合にsetup()で呼んでおくと，再生のたびにI2Sの
+     * ドライバーを入れ直さない（ヒープを確保しない）ようになります。
+     *
+     * @retval true スピーカーが使える
+     * @retval false スピーカーが使えない
      */
-    virtual bool playWav(FS& fs, const char* filename);
+    virtual bool useSpeaker(void);
+
+    /*
+     * マイクを使えるようにします。
+     * マイクとスピーカーはI2Sを共有しているため，再生中は使えません。
+     *
+     * @retval true マイクが使える
+     * @retval false 再生中などでマイクが使えない
+     */
+    virtual bool listen(void);
+
+    /*
+     * マイクが使えるかを返します。
+     *
+     * @retval true マイクが使える
+     * @retval false マイクが使えない
+     */
+    virtual bool isListening(void) const;
+
+    /*
+     * マイクの録音を予約します。待たずに戻ります。
+     *
+     * @param buf 録音したサンプルを入れるバッファ
+     * @param len サンプル数
+     * @param rate サンプリング周波数（Hz）
+     * @retval true 予約できた
+     * @retval false 再生中などで予約できなかった
+     */
+    virtual bool record(int16_t* buf, size_t len, uint32_t rate);
+
+    /*
+     * 予約中（録音中を含む）の録音の数を返します。
+     *
+     * @return 予約中の録音の数
+     */
+    virtual size_t getRecordingCount(void) const;
 
     /*
      * 指定した色でLEDを光らせます。
@@ -107,6 +215,43 @@ protected:
      */
     virtual uint8_t getColorValue(uint8_t v) const;
 
+    /*
+     * openWav()で開いたWAVファイルを再生します。
+     * I2Sをスピーカーに切り替えてから呼ぶこと
+     *
+     * @param generation 再生を始めたときのstopWav()の呼び出し回数
+     * @param start 再生を始めた時刻（ミリ秒）
+     * @param timeout 再生にかけてよい時間（ミリ秒）
+     */
+    virtual bool playWavFile(uint32_t generation, uint32_t start,
+                             uint32_t timeout);
+
+    /*
+     * I2Sをスピーカーに切り替えます。_i2sLockを取ってから呼ぶこと
+     *
+     * @retval true スピーカーが使える
+     * @retval false スピーカーが使えない
+     */
+    virtual bool switchToSpeaker(void);
+
+    /*
+     * I2Sをマイクに切り替えます。_i2sLockを取ってから呼ぶこと
+     *
+     * @retval true マイクが使える
+     * @retval false マイクが使えない
+     */
+    virtual bool switchToMic(void);
+
 private:
     uint8_t _brightness;
+    SemaphoreHandle_t _i2sLock;
+    std::atomic<uint32_t> _stopGeneration;
+    File _wavFile;
+    FS* _wavFs;
+    const char* _wavFilename;
+    uint32_t _wavDataOffset;
+    uint32_t _wavDataLength;
+    uint32_t _wavSampleRate;
+    bool _wavStereo;
+    bool _wav16bit;
 };
\ No newline at end of file
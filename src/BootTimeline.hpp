@@ -0,0 +1,125 @@
+#pragma once
+
+#include <Arduino.h>
+#include <esp_log.h>
+
+#include <array>
+
+/*
+ * 起動処理の各フェーズの開始・終了時刻を記録するクラス
+ * 複数のタスクから並行して記録できます。
+ * 時刻はmicros()（esp_timerの起動から）で測るため，ROMとブートローダーの
+ * 時間は含みません。
+ *
+ * @param MAX_PHASES 記録できるフェーズの最大数
+ */
+template <std::size_t MAX_PHASES = 16>
+class BootTimeline {
+public:
+    /* 不正なフェーズID */
+    static constexpr std::size_t INVALID_PHASE = MAX_PHASES;
+
+    /*
+     * コンストラクタ
+     */
+    BootTimeline(void) : _lock(portMUX_INITIALIZER_UNLOCKED), _count(0) {
+    }
+
+    /*
+     * デストラクタ
+     */
+    ~BootTimeline(void) {
+    }
+
+    /*
+     * フェーズの開始を記録します。
+     *
+     * @param name フェーズ名（静的な文字列であること）
+     * @return フェーズID。記録できなかった場合はINVALID_PHASE
+     */
+    std::size_t start(const char* name) {
+        const uint32_t now = micros();
+        std::size_t id = INVALID_PHASE;
+        portENTER_CRITICAL(&this->_lock);
+        if (this->_count < MAX_PHASES) {
+            id = this->_count++;
+            this->_phases[id] = {name, now, 0};
+        }
+        portEXIT_CRITICAL(&this->_lock);
+        return id;
+    }
+
+    /*
+     * フェーズの終了を記録します。
+     *
+     * @param id start()が返したフェーズID
+     */
+    void finish(std::size_t id) {
+        const uint32_t now = micros();
+        if (id >= MAX_PHASES) {
+            return;
+        }
+        portENTER_CRITICAL(&this->_lock);
+        this->_phases[id].endUs = now;
+        portEXIT_CRITICAL(&this->_lock);
+    }
+
+    /*
+     * アプリケーションの起動（esp_timerの起動）からの経過時間（ミリ秒）を
+     * 返します。ROMとブートローダーの時間は含みません。
+     *
+     * @return 経過時間（ミリ秒）
+     */
+    uint32_t elapsed(void) const {
+        return micros() / 1000;
+    }
+
+    /*
+     * 記録したフェーズをログに出力します。
+     *
+     * @param targetMs 目標の起動時間（ミリ秒）。超えた場合は警告を出します
+     * @retval true 目標時間内に起動できた
+     * @retval false 目標時間を超えた
+     */
+    bool report(uint32_t targetMs) const {
+        // 別のタスクがまだ記録しているかもしれないため，写してから出力する
+        std::array<phase_t, MAX_PHASES> phases;
+        portENTER_CRITICAL(&this->_lock);
+        const std::size_t count = this->_count;
+        for (std::size_t i = 0; i < count; ++i) {
+            phases[i] = this->_phases[i];
+        }
+        portEXIT_CRITICAL(&this->_lock);
+        ESP_LOGI("Boot", "Times from app start (ROM/bootloader excluded)");
+        for (std::size_t i = 0; i < count; ++i) {
+            const phase_t& p = phases[i];
+            if (p.endUs == 0) {
+                ESP_LOGI("Boot", "%-12s %7.1fms -      (running)", p.name,
+                         p.startUs / 1000.0f);
+            } else {
+                ESP_LOGI("Boot", "%-12s %7.1fms - %7.1fms (%7.1fms)", p.name,
+                         p.startUs / 1000.0f, p.endUs / 1000.0f,
+                         (p.endUs - p.startUs) / 1000.0f);
+            }
+        }
+        const uint32_t total = elapsed();
+        if (total > targetMs) {
+            ESP_LOGW("Boot", "Armed in %dms (target: %dms)", total, targetMs);
+            return false;
+        }
+        ESP_LOGI("Boot", "Armed in %dms (target: %dms)", total, targetMs);
+        return true;
+    }
+
+private:
+    struct phase_t
+    {
+        const char* name;
+        uint32_t startUs;
+        uint32_t endUs;
+    };
+
+    mutable portMUX_TYPE _lock;
+    std::size_t _count;
+    std::array<phase_t, MAX_PHASES> _phases;
+};
@@ -0,0 +1,180 @@
+#pragma once
+
+#include <Preferences.h>
+#include <esp_log.h>
+#include <esp_rom_crc.h>
+#include <stddef.h>
+#include <string.h>
+
+/*
+ * NVSに保存する校正モデル
+ * フィールドは末尾にのみ追加すること（古いバージョンのデータを読めるように）
+ */
+struct __attribute__((packed)) calibration_model_t
+{
+    /* ---- ヘッダー ---- */
+    /* モデルのバージョン */
+    uint16_t version;
+    /* モデル全体のサイズ（バイト） */
+    uint16_t size;
+    /* ヘッダー以降のCRC32 */
+    uint32_t checksum;
+    /* ---- version 1 ---- */
+    /* 閾値（何もないときの距離の平均値，mm） */
+    uint16_t baseline;
+    /* 距離の分散（mm^2） */
+    uint32_t noiseVariance;
+    /* 1回の測定にかける時間（マイクロ秒） */
+    uint32_t timingBudget;
+    /* version 1の末尾にあった移動平均のウィンドウサイズ（uint8_t）は，
+     * 発火の判定が使わないためversion 2で削除した */
+};
+
+/*
+ * 校正モデルをNVSに保存・読み込みするクラス
+ */
+class CalibrationStore {
+public:
+    /* 現在の校正モデルのバージョン */
+    static constexpr uint16_t VERSION = 2;
+    /* ヘッダーのサイズ */
+    static constexpr size_t HEADER_SIZE =
+        offsetof(calibration_model_t, baseline);
+    /* 読み込める校正モデルの最大サイズ（新しいバージョンも読めるように） */
+    static constexpr size_t MAX_SIZE = 128;
+
+    /*
+     * コンストラクタ
+     *
+     * @param prefs 開いているPreferences
+     * @param key 校正モデルを保存するキー（15文字以内）
+     * @param legacyKey 以前の閾値のみを保存していたキー（15文字以内）
+     */
+    CalibrationStore(Preferences& prefs, const char* key,
+                     const char* legacyKey)
+        : _prefs(prefs), _key(key), _legacyKey(legacyKey) {
+    }
+
+    /*
+     * デストラクタ
+     */
+    virtual ~CalibrationStore(void) {
+    }
+
+    /*
+     * 校正モデルを読み込みます。
+     * 保存されていないフィールドはmodelの値（デフォルト値）のまま残ります。
+     * 古いバージョンのデータは読み込んだ後に現在のバージョンで保存し直します。
+     *
+     * @param model 校正モデル。デフォルト値を入れてから呼ぶこと
+     * @retval true 読み込めた
+     * @retval false 保存されていない，もしくは壊れていた
+     */
+    virtual bool load(calibration_model_t& model) {
+        const size_t len = this->_prefs.getBytesLength(this->_key);
+        if (len == 0) {
+            return migrateLegacy(model);
+        }
+        if (len < HEADER_SIZE || len > MAX_SIZE) {
+            ESP_LOGE("Calibration", "Illegal size: %d", len);
+            return false;
+        }
+        uint8_t buf[MAX_SIZE];
+        if (this->_prefs.getBytes(this->_key, buf, len) != len) {
+            ESP_LOGE("Calibration", "Failed to read %s", this->_key);
+            return false;
+        }
+        calibration_model_t header;
+        memcpy(&header, buf, HEADER_SIZE);
+        if (header.size != len) {
+            ESP_LOGE("Calibration", "Size mismatch: %d(stored: %d)", len,
+                     header.size);
+            return false;
+        }
+        if (header.checksum != checksum(buf, len)) {
+            ESP_LOGE("Calibration", "Checksum mismatch");
+            return false;
+        }
+        const size_t n = len < sizeof(calibration_model_t)
+                             ? len
+                             : sizeof(calibration_model_t);
+        memcpy(reinterpret_cast<uint8_t*>(&model) + HEADER_SIZE,
+               buf + HEADER_SIZE, n - HEADER_SIZE);
+        ESP_LOGI("Calibration", "Loaded version %d (%d bytes)", header.version,
+                 len);
+        if (header.version < VERSION) {
+            ESP_LOGI("Calibration", "Migrating version %d to %d",
+                     header.version, VERSION);
+            return save(model);
+        }
+        return true;
+    }
+
+    /*
+     * 校正モデルを保存します。
+     * バージョン，サイズ，チェックサムはこの関数で設定します。
+     * 以前のファームウェアに戻しても同じ閾値を使えるよう，以前のキーにも
+     * 閾値を書きます。
+     *
+     * @param model 校正モデル
+     * @retval true 保存できた
+     * @retval false 保存できなかった
+     */
+    virtual bool save(calibration_model_t& model) {
+        model.version = VERSION;
+        model.size = sizeof(calibration_model_t);
+        model.checksum = checksum(reinterpret_cast<const uint8_t*>(&model),
+                                  sizeof(calibration_model_t));
+        if (this->_prefs.putBytes(this->_key, &model,
+                                  sizeof(calibration_model_t)) !=
+            sizeof(calibration_model_t)) {
+            ESP_LOGE("Calibration", "Failed to write %s", this->_key);
+            return false;
+        }
+        if (this->_legacyKey != nullptr &&
+            this->_prefs.getUShort(this->_legacyKey, 0) != model.baseline &&
+            this->_prefs.putUShort(this->_legacyKey, model.baseline) == 0) {
+            ESP_LOGW("Calibration", "Failed to write %s", this->_legacyKey);
+        }
+        return true;
+    }
+
+protected:
+    /*
+     * 閾値のみを保存していた以前の形式から校正モデルを作ります。
+     * 以前のキーは以前のファームウェアに戻した場合のために残します。
+     *
+     * @param model 校正モデル
+     * @retval true 以前の形式から移行できた
+     * @retval false 以前の形式でも保存されていなかった
+     */
+    virtual bool migrateLegacy(calibration_model_t& model) {
+        if (this->_legacyKey == nullptr ||
+            !this->_prefs.isKey(this->_legacyKey)) {
+            return false;
+        }
+        const uint16_t threshold = this->_prefs.getUShort(this->_legacyKey, 0);
+        if (threshold == 0) {
+            return false;
+        }
+        ESP_LOGI("Calibration", "Migrating legacy threshold: %dmm", threshold);
+        model.baseline = threshold;
+        return save(model);
+    }
+
+    /*
+     * ヘッダー以降のチェックサムを計算します。
+     *
+     * @param buf 校正モデルのデータ
+     * @param len データの長さ
+     * @return チェックサム
+     */
+    static uint32_t checksum(const uint8_t* buf, size_t len) {
+        return esp_rom_crc32_le(0, buf + HEADER_SIZE, len - HEADER_SIZE);
+    }
+
+private:
+    Preferences& _prefs;
+    const char* _key;
+    const char* _legacyKey;
+};
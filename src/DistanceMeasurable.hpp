@@ -3,17 +3,60 @@
 #include <esp_log.h>
 #include <stdint.h>
 
-#include "MovingMean.hpp"
+#include "SensorHealthMonitor.hpp"
+
+/*
+ * 測定の状態（VL53L0XのAPIのRangeStatusと同じ値）
+ */
+enum range_status_t
+{
+    /* 正しく測定できた */
+    RANGE_VALID = 0,
+    /* 測定値のばらつきが大きすぎる */
+    RANGE_SIGMA_FAIL = 1,
+    /* 反射光が弱すぎる */
+    RANGE_SIGNAL_FAIL = 2,
+    /* 近すぎる，もしくは反射が強すぎる */
+    RANGE_MIN_RANGE_FAIL = 3,
+    /* 位相が折り返した（遠すぎる物を近くにあると誤測定した） */
+    RANGE_PHASE_FAIL = 4,
+    /* ハードウェアの異常 */
+    RANGE_HARDWARE_FAIL = 5,
+    /* 測定値が更新されていない */
+    RANGE_NO_UPDATE = 255,
+};
+
+/*
+ * 1回の測定の結果
+ *
+ * @param T 距離の型
+ */
+template <class T>
+struct distance_sample_t
+{
+    /* 測定した距離 */
+    T distance;
+    /* 測定の状態 */
+    range_status_t status;
+    /* 反射光の強さ（MCPS，下位7ビットが小数部の固定小数点数） */
+    uint16_t signalRate;
+    /* 環境光の強さ（MCPS，下位7ビットが小数部の固定小数点数） */
+    uint16_t ambientRate;
+    /* 測定値の信頼度（0-255）。0は使えない測定値 */
+    uint8_t confidence;
+};
 
 /*
  * 距離が測定できることを表す
  *
  * @param T 距離の型
- * @param WINDOW_SIZE 移動平均のウィンドウサイズ
  */
-template <class T, size_t WINDOW_SIZE>
+template <class T>
 class DistanceMeasurable {
 public:
+    /* 測定値の信頼度の最大値 */
+    static constexpr uint8_t MAX_CONFIDENCE = 255;
+
     /*
      * デストラクタ
      */
@@ -44,6 +87,26 @@ public:
      */
     virtual bool getDistance(T& distance) = 0;
 
+    /*
+     * 測定した距離を，測定の状態と信頼度と一緒に返します。
+     * 測定の状態を取れないセンサーでは，測定できた距離の信頼度を
+     * 最大値とします。
+     *
+     * @param sample 測定の結果
+     * @retval true 測定できた場合（信頼度が0のこともある）
+     * @retval false 測定できなかった場合
+     */
+    virtual bool getSample(distance_sample_t<T>& sample) {
+        if (getDistance(sample.distance) == false) {
+            return false;
+        }
+        sample.status = RANGE_VALID;
+        sample.signalRate = 0;
+        sample.ambientRate = 0;
+        sample.confidence = MAX_CONFIDENCE;
+        return true;
+    }
+
     /*
      * 測定できる最小長を返します。
      *
@@ -65,6 +128,57 @@ public:
      */
     virtual double getAccuracy(void) const = 0;
 
+    /*
+     * 測定できなくなったセンサーを復旧させます。
+     * 1回の呼び出しにかかる時間には上限があること
+     *
+     * @param level 復旧処理の段階
+     * @retval true 復旧処理ができた
+     * @retval false 復旧処理ができなかった
+     */
+    virtual bool recover(sensor_recovery_t level) {
+        return false;
+    }
+
+    /*
+     * 1回の測定にかける時間を設定します。
+     * begin()の前に呼ぶこと
+     *
+     * @param us 測定時間（マイクロ秒）
+     * @retval true 設定できた
+     * @retval false 設定できなかった
+     */
+    virtual bool setTimingBudget(uint32_t us) {
+        return false;
+    }
+
+    /*
+     * 1回の測定にかける時間を返します。
+     *
+     * @return 測定時間（マイクロ秒）。設定できない場合は0
+     */
+    virtual uint32_t getTimingBudget(void) const {
+        return 0;
+    }
+
+    /*
+     * 校正で求めた距離の分散を返します。
+     *
+     * @return 距離の分散（mm^2）
+     */
+    virtual uint32_t getNoiseVariance(void) const {
+        return this->_noiseVariance;
+    }
+
+    /*
+     * 保存しておいた校正結果の距離の分散を設定します。
+     *
+     * @param variance 距離の分散（mm^2）
+     */
+    virtual void setNoiseVariance(uint32_t variance) {
+        this->_noiseVariance = variance;
+    }
+
     /*
      * 指定した回数だけ距離を測り，閾値を返します。
      * begin()を呼んだ後に呼ぶこと
@@ -75,8 +189,12 @@ public:
      */
     virtual T calibrate(uint8_t count,
                         void (*callback)(uint8_t count) = nullptr) {
+        if (count == 0) {
+            return 0;
+        }
         uint8_t c = 0;
-        double sum = 0;
+        uint32_t sum = 0;
+        uint64_t sumSq = 0;
         T distance = 0;
         while (c < count) {
             if (getDistance(distance) == false) {
@@ -89,14 +207,22 @@ public:
             }
             ++c;
             sum += distance;
+            sumSq += static_cast<uint32_t>(distance) * distance;
             if (callback != nullptr) {
                 callback(c);
             }
             ESP_LOGI(getName(), "Calibration %3d: Distance: %dmm", c, distance);
         }
-        return static_cast<T>(sum / count);
+        const T mean = static_cast<T>(sum / count);
+        // 分散 = (n * Σx^2 - (Σx)^2) / n^2
+        const uint64_t n2 = static_cast<uint64_t>(count) * count;
+        this->_noiseVariance = static_cast<uint32_t>(
+            (sumSq * count - static_cast<uint64_t>(sum) * sum + n2 / 2) / n2);
+        ESP_LOGI(getName(), "Calibration: Noise Variance: %dmm^2",
+                 this->_noiseVariance);
+        return mean;
     };
 
 protected:
-    MovingMean<T, WINDOW_SIZE> _mm;
+    uint32_t _noiseVariance = 0;
 };
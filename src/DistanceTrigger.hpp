@@ -1,26 +1,82 @@
 #pragma once
 
+#include <Arduino.h>
 #include <esp_log.h>
 
+#include <array>
+
 #include "DistanceMeasurable.hpp"
+#include "HotPath.hpp"
+#include "NumericPolicy.hpp"
 #include "Triggerable.hpp"
 
+/*
+ * 発火の予測の結果
+ */
+enum trigger_prediction_t
+{
+    /* 変化なし */
+    PREDICTION_NONE,
+    /* 次の測定までに閾値を下回ると予測した */
+    PREDICTION_ARMED,
+    /* 予測した通りに発火した */
+    PREDICTION_CONFIRMED,
+    /* 予測が外れた */
+    PREDICTION_CANCELLED,
+};
+
 /*
  * 測定した距離が閾値より短かくなったことをきっかけに発火するトリガー
+ *
+ * @param T 距離の型
+ * @param P 発火する距離の範囲を求めるのに使う数値ポリシー
+ *          （FixedPointPolicy，比較用にFloatPolicy）
  */
-template <class T, size_t WINDOW_SIZE>
+template <class T, class P = FixedPointPolicy>
 class DistanceTrigger : public Triggerable {
 public:
+#if defined(TRIGGER_PROFILE)
+    /* 判定にかかったサイクル数と測定の間隔をログに出す間隔（測定回数） */
+    static constexpr uint32_t PROFILE_INTERVAL = 1000;
+#endif
+    /* 近づく速さを求めるのに使う測定回数 */
+    static constexpr std::size_t PREDICTION_SAMPLES = 3;
+    /*
+     * 近づいているとみなす距離の変化（ノイズの標準偏差の倍数，デフォルト）
+     * tools/prediction_evalで3倍では予測が外れる回数が多すぎたため6倍にした
+     */
+    static constexpr uint32_t DEFAULT_PREDICTION_SIGMAS = 6;
+    /* 発火の判定に使う最小の信頼度（デフォルト） */
+    static constexpr uint8_t DEFAULT_MIN_CONFIDENCE = 64;
+
     /*
      * コンストラクタ
      *
      * @param measurable DistanceMeasurableのインスタンス
      */
-    DistanceTrigger(DistanceMeasurable<T, WINDOW_SIZE>* measurable)
+    DistanceTrigger(DistanceMeasurable<T>* measurable)
         : _initialized(false),
           _enabled(false),
           _measurable(measurable),
-          _threshold(0) {
+          _threshold(0),
+          _lower(0),
+          _upper(0),
+          _margin(measurable != nullptr ? measurable->getAccuracy() : 0.0),
+          _refractoryPeriod(0),
+          _lastFired(0),
+          _fired(false),
+          _minConfidence(DEFAULT_MIN_CONFIDENCE),
+          _rejected(0),
+          _health(),
+          _lookahead(0),
+          _predictionSigmas(DEFAULT_PREDICTION_SIGMAS),
+          _history{},
+          _historyTime{},
+          _historySize(0),
+          _historyIndex(0),
+          _armed(false),
+          _armedAt(0),
+          _prediction(PREDICTION_NONE) {
     }
 
     /*
@@ -61,6 +117,7 @@ public:
         if (this->_initialized) {
             this->_initialized = setThreshold(threshold);
         }
+        this->_health.reset(millis());
         return this->_initialized;
     }
 
@@ -79,24 +136,31 @@ public:
             ESP_LOGV("Trigger", "Disabled");
             return false;
         }
-        T distance = 0;
-        if (this->_measurable->getDistance(distance) == false) {
+        expire(millis());
+        distance_sample_t<T> sample;
+        if (this->_measurable->getSample(sample) == false) {
+            this->_historySize = 0;
+            const sensor_recovery_t level = this->_health.onFailure(millis());
+            if (level != RECOVERY_NONE) {
+                this->_measurable->recover(level);
+            }
             return false;
         }
-        const double acc = this->_measurable->getAccuracy();
-        const T lower = static_cast<T>(
-            this->_measurable->getMinDistance() * (1.0 + acc) + 0.5);
-        const T upper = static_cast<T>(this->_threshold * (1.0 - acc) + 0.5);
-        const bool triggered = lower < distance && distance < upper;
-        if (triggered) {
-            ESP_LOGI("Trigger", "Fired: %dmm (%dmm, %dmm)", distance, lower,
-                     upper);
-        } else {
-            ESP_LOGD("Trigger",
-                     "Moving Mean Distance(window: %d): %dmm (%dmm, %dmm)",
-                     WINDOW_SIZE, distance, lower, upper);
+        const uint32_t now = millis();
+        this->_health.onSuccess(now);
+        if (sample.confidence == 0 ||
+            sample.confidence < this->_minConfidence) {
+            reject(sample);
+            return false;
         }
+#if defined(TRIGGER_PROFILE)
+        const uint32_t start = ESP.getCycleCount();
+        const bool triggered = decide(sample, now);
+        profile(ESP.getCycleCount() - start, micros());
         return triggered;
+#else
+        return decide(sample, now);
+#endif
     }
 
     /*
@@ -126,6 +190,10 @@ public:
             return false;
         }
         this->_enabled = false;
+        this->_historySize = 0;
+        if (this->_armed) {
+            cancel();
+        }
         return true;
     }
 
@@ -154,7 +222,382 @@ public:
         return this->_measurable->calibrate(count, callback);
     }
 
+    /*
+     * 閾値からのマージンを設定します。
+     * 測定値が閾値 * (1 - margin)より短くなると発火します。
+     * デフォルトは測定精度と同じです。
+     *
+     * @param margin マージン（パーセント：0.0-1.0）
+     * @retval true 設定できた
+     * @retval false 設定できなかった
+     */
+    virtual bool setMargin(double margin) {
+        if (margin < 0.0 || margin >= 1.0) {
+            ESP_LOGE("Trigger", "Illegal Margin: %f", margin);
+            return false;
+        }
+        this->_margin = margin;
+        if (this->_measurable != nullptr) {
+            updateBounds();
+        }
+        return true;
+    }
+
+    /*
+     * 発火してから次に発火できるようになるまでの時間を設定します。
+     * 1回の通過で何度も発火しないようにします。
+     *
+     * @param ms 次に発火できるようになるまでの時間（ミリ秒）
+     */
+    virtual void setRefractoryPeriod(uint32_t ms) {
+        this->_refractoryPeriod = ms;
+    }
+
+    /*
+     * 発火の判定に使う最小の信頼度を設定します。
+     * 信頼度がこれより低い測定（反射光が弱い，位相が折り返したなど）は
+     * 捨て，発火にも予測にも使いません。
+     *
+     * @param confidence 最小の信頼度（0-255）
+     */
+    virtual void setMinConfidence(uint8_t confidence) {
+        this->_minConfidence = confidence;
+    }
+
+    /*
+     * 発火の判定に使う最小の信頼度を返します。
+     *
+     * @return 最小の信頼度
+     */
+    inline uint8_t getMinConfidence(void) const {
+        return this->_minConfidence;
+    }
+
+    /*
+     * 信頼度が低いために捨てた測定の回数を返します。
+     *
+     * @return 捨てた測定の回数
+     */
+    inline uint32_t getRejectedCount(void) const {
+        return this->_rejected;
+    }
+
+    /*
+     * 発火を予測する時間を設定します。
+     * 直近の測定から近づく速さを求め，この時間内に閾値を下回ると予測したら
+     * pollPrediction()がPREDICTION_ARMEDを返します。
+     * 予測した時刻から測定1回分を過ぎても発火しなければ予測を取り消します。
+     *
+     * @param us 予測する時間（マイクロ秒）。0なら予測しない（デフォルト）
+     */
+    virtual void setLookahead(uint32_t us) {
+        this->_lookahead = us;
+        this->_historySize = 0;
+    }
+
+    /*
+     * 近づいているとみなす距離の変化を，ノイズの標準偏差の倍数で設定します。
+     * 小さくすると早く予測できますが，予測が外れる回数が増えます。
+     *
+     * @param sigmas ノイズの標準偏差の倍数
+     */
+    virtual void setPredictionSigmas(uint32_t sigmas) {
+        this->_predictionSigmas = sigmas;
+    }
+
+    /*
+     * 発火を予測する時間を返します。
+     *
+     * @return 予測する時間（マイクロ秒）
+     */
+    inline uint32_t getLookahead(void) const {
+        return this->_lookahead;
+    }
+
+    /*
+     * 前回呼び出してからの予測の結果を返します。
+     * isTriggered()の後に呼ぶこと
+     *
+     * @return 予測の結果
+     */
+    virtual trigger_prediction_t pollPrediction(void) {
+        const trigger_prediction_t prediction = this->_prediction;
+        this->_prediction = PREDICTION_NONE;
+        return prediction;
+    }
+
+    /*
+     * 1回の測定にかける時間を設定します。
+     * begin()の前に呼ぶこと
+     *
+     * @param us 測定時間（マイクロ秒）
+     * @retval true 設定できた
+     * @retval false 設定できなかった
+     */
+    virtual bool setTimingBudget(uint32_t us) {
+        if (this->_measurable == nullptr) {
+            return false;
+        }
+        return this->_measurable->setTimingBudget(us);
+    }
+
+    /*
+     * 1回の測定にかける時間を返します。
+     *
+     * @return 測定時間（マイクロ秒）
+     */
+    virtual uint32_t getTimingBudget(void) const {
+        if (this->_measurable == nullptr) {
+            return 0;
+        }
+        return this->_measurable->getTimingBudget();
+    }
+
+    /*
+     * 校正で求めた距離の分散を返します。
+     *
+     * @return 距離の分散（mm^2）
+     */
+    virtual uint32_t getNoiseVariance(void) const {
+        if (this->_measurable == nullptr) {
+            return 0;
+        }
+        return this->_measurable->getNoiseVariance();
+    }
+
+    /*
+     * センサーの状態を監視しているインスタンスを返します。
+     *
+     * @return センサーの状態の監視
+     */
+    inline const SensorHealthMonitor& getHealth(void) const {
+        return this->_health;
+    }
+
+    /*
+     * 保存しておいた校正結果の距離の分散を設定します。
+     * 発火の判定が使う校正結果は，閾値（begin()で渡す）とこの分散（予測で
+     * 近づいているとみなす距離の変化に使う）だけです。
+     *
+     * @param variance 距離の分散（mm^2）
+     */
+    virtual void setNoiseVariance(uint32_t variance) {
+        if (this->_measurable != nullptr) {
+            this->_measurable->setNoiseVariance(variance);
+        }
+    }
+
 protected:
+    /*
+     * 測定の結果から発火するかを判定します。
+     * 発火しない測定（ほとんどの測定）では整数の比較だけで終わるため，
+     * firmware-perfではIRAMに置きます。ログの出力など，フラッシュに置かれた
+     * 処理は発火したときと予測するときだけ呼びます。
+     *
+     * @param sample 測定の結果
+     * @param now 測定した時刻（ミリ秒）
+     * @retval true 発火した
+     * @retval false 発火しなかった
+     */
+    virtual bool HOT_PATH decide(const distance_sample_t<T>& sample,
+                                 uint32_t now) {
+        const T distance = sample.distance;
+        bool triggered = this->_lower < distance && distance < this->_upper;
+        if (triggered && this->_fired &&
+            now - this->_lastFired < this->_refractoryPeriod) {
+            ESP_LOGD("Trigger", "Refractory: %dmm", distance);
+            triggered = false;
+        } else if (triggered) {
+            fire(distance, now);
+        } else {
+            ESP_LOGD("Trigger", "Distance: %dmm (%dmm, %dmm)", distance,
+                     this->_lower, this->_upper);
+        }
+        if (this->_lookahead > 0) {
+            predict(distance, triggered);
+        }
+        return triggered;
+    }
+
+    /*
+     * 発火したことを記録します。
+     *
+     * @param distance 測定した距離
+     * @param now 測定した時刻（ミリ秒）
+     */
+    void fire(T distance, uint32_t now) {
+        this->_fired = true;
+        this->_lastFired = now;
+        ESP_LOGI("Trigger", "Fired: %dmm (%dmm, %dmm)", distance,
+                 this->_lower, this->_upper);
+        if (this->_armed) {
+            this->_armed = false;
+            this->_prediction = PREDICTION_CONFIRMED;
+        }
+    }
+
+    /*
+     * 信頼度が低い測定を捨てます。
+     * 捨てた測定の前後では近づく速さが求められないため，予測に使う履歴も
+     * 捨てます。
+     *
+     * @param sample 測定の結果
+     */
+    void reject(const distance_sample_t<T>& sample) {
+        ++(this->_rejected);
+        this->_historySize = 0;
+        ESP_LOGD("Trigger",
+                 "Rejected: %dmm (status: %d, signal: %d, ambient: %d, "
+                 "confidence: %d)",
+                 sample.distance, sample.status, sample.signalRate,
+                 sample.ambientRate, sample.confidence);
+    }
+
+    /*
+     * 直近の測定から近づく速さを求め，予測する時間内に閾値を下回るかを
+     * 判定します。整数のみで計算します。
+     *
+     * @param distance 測定した距離
+     * @param triggered この測定で発火したか
+     */
+    virtual void predict(T distance, bool triggered) {
+        const uint32_t now = micros();
+        const std::size_t oldest =
+            this->_historySize < PREDICTION_SAMPLES ? 0 : this->_historyIndex;
+        const bool ready = this->_historySize >= PREDICTION_SAMPLES;
+        const int32_t dd = static_cast<int32_t>(distance) -
+                           static_cast<int32_t>(this->_history[oldest]);
+        const uint32_t dt = now - this->_historyTime[oldest];
+        const T last = this->_history[(this->_historyIndex +
+                                       PREDICTION_SAMPLES - 1) %
+                                      PREDICTION_SAMPLES];
+        this->_history[this->_historyIndex] = distance;
+        this->_historyTime[this->_historyIndex] = now;
+        this->_historyIndex = (this->_historyIndex + 1) % PREDICTION_SAMPLES;
+        if (this->_historySize < PREDICTION_SAMPLES) {
+            ++(this->_historySize);
+        }
+        if (!ready || triggered) {
+            return;
+        }
+        // 2回の測定の差のノイズの分散は1回の測定の2倍になる
+        const uint64_t variance =
+            this->_measurable->getNoiseVariance() > 0
+                ? this->_measurable->getNoiseVariance()
+                : 1;
+        // 直前の測定からも近づいていること
+        const bool approaching =
+            dd < 0 && distance < last &&
+            static_cast<uint64_t>(dd) * dd >
+                2 * static_cast<uint64_t>(this->_predictionSigmas) *
+                    this->_predictionSigmas * variance;
+        if (this->_armed) {
+            if (dd >= 0) {
+                cancel();
+            }
+            return;
+        }
+        if (!approaching || distance < this->_upper ||
+            (this->_fired &&
+             millis() - this->_lastFired < this->_refractoryPeriod)) {
+            return;
+        }
+        // (distance - upper) / (-dd / dt) <= lookahead
+        const uint64_t gap = static_cast<uint64_t>(distance - this->_upper);
+        if (gap * dt <= static_cast<uint64_t>(-dd) * this->_lookahead) {
+            this->_armed = true;
+            this->_armedAt = millis();
+            this->_prediction = PREDICTION_ARMED;
+            ESP_LOGI("Trigger", "Armed: %dmm, %dmm in %dus", distance, dd, dt);
+        }
+    }
+
+    /*
+     * 予測した時刻から測定1回分を過ぎても発火していなければ予測を取り消します。
+     *
+     * @param now 現在時刻（ミリ秒）
+     */
+    void expire(uint32_t now) {
+        if (!this->_armed) {
+            return;
+        }
+        const uint32_t deadline =
+            (this->_lookahead + getTimingBudget()) / 1000 + 1;
+        if (now - this->_armedAt > deadline) {
+            cancel();
+        }
+    }
+
+    /*
+     * 予測を取り消します。
+     */
+    void cancel(void) {
+        this->_armed = false;
+        this->_prediction = PREDICTION_CANCELLED;
+        ESP_LOGI("Trigger", "Prediction cancelled");
+    }
+
+    /*
+     * 閾値，測定精度，マージンから発火する距離の範囲を求めます。
+     * 閾値かマージンが変わったときだけ呼ぶこと
+     */
+    virtual void updateBounds(void) {
+#if defined(TRIGGER_PROFILE)
+        const uint32_t start = ESP.getCycleCount();
+#endif
+        const typename P::ratio_t acc =
+            P::ratio(this->_measurable->getAccuracy());
+        const typename P::ratio_t margin = P::ratio(this->_margin);
+        this->_lower =
+            P::template scaleUp<T>(this->_measurable->getMinDistance(), acc);
+        this->_upper = P::template scaleDown<T>(this->_threshold, margin);
+#if defined(TRIGGER_PROFILE)
+        ESP_LOGI("Trigger", "Bounds: %d cycles (%dmm, %dmm)",
+                 ESP.getCycleCount() - start, this->_lower, this->_upper);
+#endif
+    }
+
+#if defined(TRIGGER_PROFILE)
+    /*
+     * 判定にかかったサイクル数と測定の間隔を集計し，一定回数ごとにログに
+     * 出します。フラッシュへの書き込みなどで測定が止まると，間隔の最大値が
+     * 測定時間より長くなります。
+     *
+     * @param cycles 判定にかかったサイクル数
+     * @param now 判定が終わった時刻（マイクロ秒）
+     */
+    void profile(uint32_t cycles, uint32_t now) {
+        this->_profileCycles += cycles;
+        if (cycles > this->_profileMaxCycles) {
+            this->_profileMaxCycles = cycles;
+        }
+        if (this->_profileLast != 0) {
+            const uint32_t interval = now - this->_profileLast;
+            this->_profileInterval += interval;
+            if (interval > this->_profileMaxInterval) {
+                this->_profileMaxInterval = interval;
+            }
+        }
+        this->_profileLast = now;
+        if (++(this->_profileCount) >= PROFILE_INTERVAL) {
+            ESP_LOGI("Trigger",
+                     "Decision: %d cycles/sample (max: %d), interval: %dus "
+                     "(max: %dus), rejected: %d",
+                     static_cast<int>(this->_profileCycles /
+                                      this->_profileCount),
+                     this->_profileMaxCycles,
+                     static_cast<int>(this->_profileInterval /
+                                      this->_profileCount),
+                     this->_profileMaxInterval, this->_rejected);
+            this->_profileCycles = 0;
+            this->_profileMaxCycles = 0;
+            this->_profileInterval = 0;
+            this->_profileMaxInterval = 0;
+            this->_profileCount = 0;
+        }
+    }
+#endif
+
     /*
      * 距離の閾値を設定します。
      *
@@ -171,6 +614,7 @@ protected:
             return false;
         } else {
             this->_threshold = distance;
+            updateBounds();
             return true;
         }
     }
@@ -178,6 +622,32 @@ protected:
 private:
     bool _initialized;
     bool _enabled;
-    DistanceMeasurable<T, WINDOW_SIZE>* _measurable;
+    DistanceMeasurable<T>* _measurable;
     T _threshold;
+    T _lower;
+    T _upper;
+    double _margin;
+    uint32_t _refractoryPeriod;
+    uint32_t _lastFired;
+    bool _fired;
+    uint8_t _minConfidence;
+    uint32_t _rejected;
+    SensorHealthMonitor _health;
+    uint32_t _lookahead;
+    uint32_t _predictionSigmas;
+    std::array<T, PREDICTION_SAMPLES> _history;
+    std::array<uint32_t, PREDICTION_SAMPLES> _historyTime;
+    std::size_t _historySize;
+    std::size_t _historyIndex;
+    bool _armed;
+    uint32_t _armedAt;
+    trigger_prediction_t _prediction;
+#if defined(TRIGGER_PROFILE)
+    uint64_t _profileCycles = 0;
+    uint32_t _profileMaxCycles = 0;
+    uint64_t _profileInterval = 0;
+    uint32_t _profileMaxInterval = 0;
+    uint32_t _profileLast = 0;
+    uint32_t _profileCount = 0;
+#endif
 };
@@ -0,0 +1,259 @@
+#include "HeapGuard.hpp"
+
+#include <esp_heap_caps.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <sys/reent.h>
+
+#include <atomic>
+
+#if defined(HEAP_GUARD)
+/* 1行のログの最大の長さ（超えた分は切り捨てる） */
+static constexpr size_t LOG_LINE_SIZE = 256;
+/* log_printf()がヒープを使わずに出力できる長さ（64文字未満） */
+static constexpr size_t LOG_CHUNK_SIZE = 63;
+
+static std::atomic<uint32_t> allocCount(0);
+static std::atomic<uint32_t> freeCount(0);
+static std::atomic<uint32_t> uncountedCount(0);
+static TaskHandle_t volatile lastTask = nullptr;
+static void* volatile lastCaller = nullptr;
+static const char* volatile uncountedReason = nullptr;
+static StaticSemaphore_t logLockBuffer;
+static SemaphoreHandle_t logLock = xSemaphoreCreateMutexStatic(&logLockBuffer);
+
+/*
+ * ヒープの操作を記録します。
+ *
+ * @param counter 増やす回数
+ * @param caller 呼び出し元の戻りアドレス
+ */
+static inline void recordHeapActivity(std::atomic<uint32_t>& counter,
+                                      void* caller) {
+    counter.fetch_add(1, std::memory_order_relaxed);
+    lastTask = xTaskGetCurrentTaskHandle();
+    lastCaller = caller;
+}
+
+// -Wl,--wrap=<関数名>で置き換えたmalloc，free等
+// newlibの内部（fopen()など）は_malloc_r等を直接呼ぶため，それも置き換える
+extern "C" {
+void* __real_malloc(size_t size);
+void* __real_calloc(size_t n, size_t size);
+void* __real_realloc(void* ptr, size_t size);
+void __real_free(void* ptr);
+void* __real__malloc_r(struct _reent* r, size_t size);
+void* __real__calloc_r(struct _reent* r, size_t n, size_t size);
+void* __real__realloc_r(struct _reent* r, void* ptr, size_t size);
+void __real__free_r(struct _reent* r, void* ptr);
+
+void* __wrap_malloc(size_t size) {
+    recordHeapActivity(allocCount, __builtin_return_address(0));
+    return __real_malloc(size);
+}
+
+void* __wrap_calloc(size_t n, size_t size) {
+    recordHeapActivity(allocCount, __builtin_return_address(0));
+    return __real_calloc(n, size);
+}
+
+void* __wrap_realloc(void* ptr, size_t size) {
+    recordHeapActivity(allocCount, __builtin_return_address(0));
+    return __real_realloc(ptr, size);
+}
+
+void __wrap_free(void* ptr) {
+    if (ptr != nullptr) {
+        recordHeapActivity(freeCount, __builtin_return_address(0));
+    }
+    __real_free(ptr);
+}
+
+void* __wrap__malloc_r(struct _reent* r, size_t size) {
+    recordHeapActivity(allocCount, __builtin_return_address(0));
+    return __real__malloc_r(r, size);
+}
+
+void* __wrap__calloc_r(struct _reent* r, size_t n, size_t size) {
+    recordHeapActivity(allocCount, __builtin_return_address(0));
+    return __real__calloc_r(r, n, size);
+}
+
+void* __wrap__realloc_r(struct _reent* r, void* ptr, size_t size) {
+    recordHeapActivity(allocCount, __builtin_return_address(0));
+    return __real__realloc_r(r, ptr, size);
+}
+
+void __wrap__free_r(struct _reent* r, void* ptr) {
+    if (ptr != nullptr) {
+        recordHeapActivity(freeCount, __builtin_return_address(0));
+    }
+    __real__free_r(r, ptr);
+}
+
+// -Wl,--wrap=log_printfで置き換えたlog_printf
+// Arduinoのlog_printf()は64文字以上の行をmallocしたバッファに書くため，
+// 静的なバッファに書いてから64文字未満ずつ出力する。バッファは他のタスクと
+// 共有するため，ミューテックスを取ってから使う（スタックの小さなタスクから
+// 呼ばれても，1行分のスタックを使わないようにする）
+int __real_log_printf(const char* format, ...);
+
+static char logLine[LOG_LINE_SIZE];
+
+int __wrap_log_printf(const char* format, ...) {
+    va_list args;
+    if (xPortInIsrContext()) {
+        // 割り込みではミューテックスを取れないため，1回で出力できる長さで
+        // 切り捨てる
+        char chunk[LOG_CHUNK_SIZE + 1];
+        va_start(args, format);
+        const int len = vsnprintf(chunk, sizeof(chunk), format, args);
+        va_end(args);
+        if (len > 0) {
+            __real_log_printf("%s", chunk);
+        }
+        return len;
+    }
+    // 分けて出力した行が他のタスクのログと混ざらないようにする
+    // スケジューラーが動く前は1つのタスクしかないため，取らずに使う
+    const bool locked =
+        xTaskGetSchedulerState() == taskSCHEDULER_RUNNING &&
+        xSemaphoreTake(logLock, portMAX_DELAY) == pdTRUE;
+    va_start(args, format);
+    const int len = vsnprintf(logLine, sizeof(logLine), format, args);
+    va_end(args);
+    if (len > 0) {
+        size_t size = static_cast<size_t>(len);
+        if (size >= sizeof(logLine)) {
+            // 切り捨てても改行は残す
+            size = sizeof(logLine) - 1;
+            logLine[size - 2] = '\r';
+            logLine[size - 1] = '\n';
+        }
+        for (size_t i = 0; i < size; i += LOG_CHUNK_SIZE) {
+            const size_t n =
+                size - i < LOG_CHUNK_SIZE ? size - i : LOG_CHUNK_SIZE;
+            __real_log_printf("%.*s", static_cast<int>(n), logLine + i);
+        }
+    }
+    if (locked) {
+        xSemaphoreGive(logLock);
+    }
+    return len;
+}
+}
+#endif
+
+HeapGuard::HeapGuard(uint32_t interval)
+    : _interval(interval),
+      _armed(false),
+      _last{},
+      _lastReport(0),
+      _violations(0),
+      _size(0),
+      _names{},
+      _tasks{} {
+}
+
+HeapGuard::~HeapGuard(void) {
+}
+
+bool HeapGuard::watch(const char* name) {
+    if (name == nullptr || this->_size >= MAX_TASKS) {
+        ESP_LOGE("HeapGuard", "Failed to watch task");
+        return false;
+    }
+    this->_names[this->_size] = name;
+    this->_tasks[this->_size] = nullptr;
+    ++(this->_size);
+    return true;
+}
+
+void HeapGuard::arm(void) {
+    const heap_activity_t activity = getHeapActivity();
+    ESP_LOGI("HeapGuard", "Armed (%d allocs, %d frees before)",
+             activity.allocs, activity.frees);
+    report();
+    this->_lastReport = millis();
+    this->_armed = true;
+    this->_last = getHeapActivity();
+}
+
+bool HeapGuard::check(void) {
+    if (!this->_armed) {
+        return true;
+    }
+    const heap_activity_t now = getHeapActivity();
+    const bool uncounted = now.uncounted != this->_last.uncounted;
+    const bool clean = !uncounted && now.allocs == this->_last.allocs &&
+                       now.frees == this->_last.frees;
+    if (!clean) {
+        ++(this->_violations);
+    }
+    if (uncounted) {
+        // ドライバーなどがheap_caps_malloc()で確保した。回数はわからない
+        ESP_LOGE("HeapGuard", "Uncounted heap activity after setup: %s (%d)",
+                 now.reason != nullptr ? now.reason : "-",
+                 now.uncounted - this->_last.uncounted);
+    }
+    if (now.allocs != this->_last.allocs || now.frees != this->_last.frees) {
+        ESP_LOGW("HeapGuard",
+                 "Heap activity after setup: %d allocs, %d frees (last: %s, "
+                 "caller: %p)",
+                 now.allocs - this->_last.allocs, now.frees - this->_last.frees,
+                 now.task != nullptr ? pcTaskGetTaskName(now.task) : "-",
+                 now.caller);
+    }
+    if (millis() - this->_lastReport >= this->_interval) {
+        this->_lastReport = millis();
+        report();
+    }
+    // ログの出力はヒープを使わないため，報告の間の確保も次回に見つかる
+    this->_last = now;
+    return clean;
+}
+
+void HeapGuard::report(void) {
+    const size_t freeSize = heap_caps_get_free_size(MALLOC_CAP_8BIT);
+    const size_t minFree = heap_caps_get_minimum_free_size(MALLOC_CAP_8BIT);
+    const size_t largest = heap_caps_get_largest_free_block(MALLOC_CAP_8BIT);
+    const uint32_t fragmentation =
+        freeSize > 0 ? 100 - static_cast<uint32_t>(largest * 100 / freeSize)
+                     : 0;
+    ESP_LOGI("HeapGuard",
+             "Heap: free: %d, min free: %d, largest block: %d, "
+             "fragmentation: %d%%, violations: %d",
+             freeSize, minFree, largest, fragmentation, this->_violations);
+    for (std::size_t i = 0; i < this->_size; ++i) {
+        if (this->_tasks[i] == nullptr) {
+            this->_tasks[i] = xTaskGetHandle(this->_names[i]);
+        }
+        if (this->_tasks[i] == nullptr) {
+            ESP_LOGI("HeapGuard", "Stack: %s: not running", this->_names[i]);
+            continue;
+        }
+        // ESP-IDFではワードではなくバイト数が返る
+        ESP_LOGI("HeapGuard", "Stack: %s: %d bytes free", this->_names[i],
+                 uxTaskGetStackHighWaterMark(this->_tasks[i]));
+    }
+}
+
+heap_activity_t HeapGuard::getHeapActivity(void) {
+#if defined(HEAP_GUARD)
+    return {allocCount.load(std::memory_order_relaxed),
+            freeCount.load(std::memory_order_relaxed),
+            lastTask,
+            lastCaller,
+            uncountedCount.load(std::memory_order_relaxed),
+            uncountedReason};
+#else
+    return {0, 0, nullptr, nullptr, 0, nullptr};
+#endif
+}
+
+void HeapGuard::recordUncounted(const char* reason) {
+#if defined(HEAP_GUARD)
+    uncountedReason = reason;
+    uncountedCount.fetch_add(1, std::memory_order_relaxed);
+#endif
+}
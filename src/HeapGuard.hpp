@@ -0,0 +1,136 @@
+#pragma once
+
+#include <Arduino.h>
+#include <esp_log.h>
+
+#include <array>
+
+/*
+ * ヒープの操作の回数
+ */
+struct heap_activity_t
+{
+    /* 確保した回数（malloc，calloc，realloc） */
+    uint32_t allocs;
+    /* 解放した回数（free） */
+    uint32_t frees;
+    /* 最後に確保・解放したタスク */
+    TaskHandle_t task;
+    /* 最後に確保・解放した関数の戻りアドレス */
+    void* caller;
+    /* 数えられない確保をした回数（I2Sのドライバーの入れ直しなど） */
+    uint32_t uncounted;
+    /* 最後に数えられない確保をした理由 */
+    const char* reason;
+};
+
+/*
+ * setup()が終わった後のヒープの操作を見張るクラス
+ * 測定から発火，リアクションまでの処理ではヒープを確保しないため，
+ * loop()の1回ごとにヒープの操作の回数を調べ，増えていたらログに出します。
+ * 回数を数えるには，HEAP_GUARDを定義し，-Wl,--wrapでmalloc，free等と
+ * log_printfを置き換えてビルドすること（firmware-heapguard）。
+ * 置き換えていない場合は定期的な報告だけを行います。
+ * FreeRTOSやドライバーがheap_caps_malloc()で直接確保する分は数えられないため，
+ * そうした処理（I2Sの切り替え）はrecordUncounted()で知らせ，エラーとします。
+ * ArduinoのログはHEAP_GUARDではヒープを使わずに出力するため，ログの出力は
+ * 数えません。
+ *
+ * 定期的に，ヒープの空き，最小の空き（使用量の最大値），最大の空きブロック，
+ * 断片化の割合と，登録したタスクのスタックの最小の空きをログに出します。
+ */
+class HeapGuard {
+public:
+    /* 報告する間隔（ミリ秒，デフォルト） */
+    static constexpr uint32_t DEFAULT_REPORT_INTERVAL_MS = 60000;
+    /* スタックを見張るタスクの最大数 */
+    static constexpr std::size_t MAX_TASKS = 8;
+
+    /*
+     * コンストラクタ
+     *
+     * @param interval 報告する間隔（ミリ秒）
+     */
+    HeapGuard(uint32_t interval = DEFAULT_REPORT_INTERVAL_MS);
+
+    /*
+     * デストラクタ
+     */
+    virtual ~HeapGuard(void);
+
+    /*
+     * スタックを見張るタスクを登録します。
+     * タスクはまだ作られていなくてもよく，報告のときに名前から探します。
+     *
+     * @param name タスク名（静的な文字列であること）
+     * @retval true 登録できた
+     * @retval false 登録できなかった
+     */
+    virtual bool watch(const char* name);
+
+    /*
+     * ヒープの操作を見張り始めます。
+     * 起動時の確保がすべて終わってから呼ぶこと
+     */
+    virtual void arm(void);
+
+    /*
+     * 見張っているかを返します。
+     *
+     * @retval true 見張っている
+     * @retval false 見張っていない
+     */
+    inline bool isArmed(void) const {
+        return this->_armed;
+    }
+
+    /*
+     * 前回呼び出してからヒープの操作があったかを調べます。
+     * loop()の最後に毎回呼ぶこと。報告の間隔が過ぎていれば報告もします。
+     *
+     * @retval true ヒープの操作はなかった
+     * @retval false ヒープの操作があった
+     */
+    virtual bool check(void);
+
+    /*
+     * ヒープとスタックの状態をログに出します。
+     */
+    virtual void report(void);
+
+    /*
+     * setup()が終わった後にヒープを操作したloop()の回数を返します。
+     *
+     * @return ヒープを操作したloop()の回数
+     */
+    inline uint32_t getViolations(void) const {
+        return this->_violations;
+    }
+
+    /*
+     * 起動してからのヒープの操作の回数を返します。
+     * HEAP_GUARDが定義されていない場合は常に0です。
+     *
+     * @return ヒープの操作の回数
+     */
+    static heap_activity_t getHeapActivity(void);
+
+    /*
+     * 数えられないヒープの確保をしたことを記録します。
+     * 見張っている間に呼ばれると，次のcheck()でエラーとします。
+     * HEAP_GUARDが定義されていない場合は何もしません。
+     *
+     * @param reason 理由（静的な文字列であること）
+     */
+    static void recordUncounted(const char* reason);
+
+private:
+    const uint32_t _interval;
+    bool _armed;
+    heap_activity_t _last;
+    uint32_t _lastReport;
+    uint32_t _violations;
+    std::size_t _size;
+    std::array<const char*, MAX_TASKS> _names;
+    std::array<TaskHandle_t, MAX_TASKS> _tasks;
+};
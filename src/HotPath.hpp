@@ -0,0 +1,17 @@
+#pragma once
+
+/*
+ * 繰り返し実行する計算に付ける属性
+ * firmware-perfではIRAMに置き，フラッシュのキャッシュミスで遅れないように
+ * します。フラッシュに置かれた関数（Wire，ログ，仮想関数の先など）を
+ * 呼ぶ処理に付けても，呼び出し先でキャッシュミスが起こるため効果はありません。
+ * 呼び出し先を含めてIRAMで完結する計算（ToneDetector::process()，
+ * DistanceTrigger::decide()の発火しない場合）にだけ付けること。
+ * IRAMは小さいため，付ける処理は最小限にすること
+ */
+#if defined(PERF_FIRMWARE)
+#include <esp_attr.h>
+#define HOT_PATH IRAM_ATTR
+#else
+#define HOT_PATH
+#endif
@@ -0,0 +1,195 @@
+#include "MicTrigger.hpp"
+
+#include <esp_freertos_hooks.h>
+
+// お賽銭が落ちたときの金属音の成分
+static const std::array<float, MicTrigger::N_BINS> COIN_FREQUENCIES = {
+    3000.0f, 4500.0f, 6000.0f};
+
+// コアごとのティックの回数と，そのうちアイドルタスクが動いていた回数
+static volatile uint32_t ticks[MicTrigger::N_CORES] = {};
+static volatile uint32_t idleTicks[MicTrigger::N_CORES] = {};
+static TaskHandle_t idleTasks[MicTrigger::N_CORES] = {};
+
+MicTrigger::MicTrigger(AtomEcho& echo, BaseType_t core)
+    : _echo(echo),
+      _core(core),
+      _detector(SAMPLE_RATE, COIN_FREQUENCIES),
+      _buffers{},
+      _index(0),
+      _primed(false),
+      _enabled(false),
+      _detected(false),
+      _lastPlaying(0),
+      _task(nullptr),
+      _busyUs(0),
+      _statsStart(0),
+      _cpuUsage(0.0f),
+      _lastTicks{},
+      _lastIdleTicks{},
+      _coreLoad{} {
+}
+
+MicTrigger::~MicTrigger(void) {
+    if (this->_task != nullptr) {
+        vTaskDelete(this->_task);
+        this->_task = nullptr;
+    }
+}
+
+const char* MicTrigger::getName(void) const {
+    return "Mic";
+}
+
+bool MicTrigger::begin(void) {
+    if (this->_task != nullptr) {
+        return true;
+    }
+    // ティックの割り込みで，どのタスクが動いていたかを数える
+    for (size_t i = 0; i < N_CORES; ++i) {
+        idleTasks[i] = xTaskGetIdleTaskHandleForCPU(i);
+        if (esp_register_freertos_tick_hook_for_cpu(countTick, i) != ESP_OK) {
+            ESP_LOGW(getName(), "Failed to register tick hook for core %d", i);
+        }
+    }
+    this->_statsStart = millis();
+    if (xTaskCreatePinnedToCore(detectionTask, "mic", TASK_STACK_SIZE, this,
+                                TASK_PRIORITY, &this->_task,
+                                this->_core) != pdPASS) {
+        ESP_LOGE(getName(), "Failed to create task");
+        this->_task = nullptr;
+        return false;
+    }
+    return true;
+}
+
+bool MicTrigger::isTriggered(void) {
+    if (!this->_enabled || !this->_detected) {
+        return false;
+    }
+    this->_detected = false;
+    return true;
+}
+
+bool MicTrigger::enable(void) {
+    if (this->_enabled) {
+        ESP_LOGW(getName(), "Already enabled");
+        return false;
+    }
+    this->_detected = false;
+    this->_enabled = true;
+    return true;
+}
+
+bool MicTrigger::disable(void) {
+    if (!this->_enabled) {
+        ESP_LOGW(getName(), "Already disabled");
+        return false;
+    }
+    this->_enabled = false;
+    return true;
+}
+
+bool MicTrigger::isEnabled(void) {
+    return this->_enabled;
+}
+
+float MicTrigger::getCpuUsage(void) const {
+    return this->_cpuUsage;
+}
+
+float MicTrigger::getCoreLoad(BaseType_t core) const {
+    if (core < 0 || static_cast<size_t>(core) >= N_CORES) {
+        return 0.0f;
+    }
+    return this->_coreLoad[core];
+}
+
+void IRAM_ATTR MicTrigger::countTick(void) {
+    const BaseType_t core = xPortGetCoreID();
+    ++ticks[core];
+    if (xTaskGetCurrentTaskHandleForCPU(core) == idleTasks[core]) {
+        ++idleTicks[core];
+    }
+}
+
+void MicTrigger::updateCoreLoad(void) {
+    for (size_t i = 0; i < N_CORES; ++i) {
+        const uint32_t t = ticks[i];
+        const uint32_t idle = idleTicks[i];
+        const uint32_t dt = t - this->_lastTicks[i];
+        if (dt > 0) {
+            this->_coreLoad[i] =
+                100.0f - (idle - this->_lastIdleTicks[i]) * 100.0f / dt;
+        }
+        this->_lastTicks[i] = t;
+        this->_lastIdleTicks[i] = idle;
+    }
+}
+
+void MicTrigger::detectionTask(void* arg) {
+    MicTrigger* self = static_cast<MicTrigger*>(arg);
+    while (true) {
+        self->step();
+    }
+}
+
+void MicTrigger::step(void) {
+    const TickType_t frameTicks =
+        pdMS_TO_TICKS(FRAME_SIZE * 1000 / SAMPLE_RATE);
+    const uint32_t now = millis();
+    if (!this->_enabled || isGated(now) || !this->_echo.listen()) {
+        this->_primed = false;
+        vTaskDelay(frameTicks);
+        return;
+    }
+    // 2つのバッファを交互に使い，一方を録音している間にもう一方を処理する
+    int16_t* current = this->_buffers[this->_index];
+    if (!this->_echo.record(current, FRAME_SIZE, SAMPLE_RATE)) {
+        this->_primed = false;
+        vTaskDelay(frameTicks);
+        return;
+    }
+    this->_index ^= 1;
+    if (!this->_primed) {
+        this->_primed = true;
+        return;
+    }
+    while (this->_echo.getRecordingCount() > 1) {
+        vTaskDelay(1);
+    }
+    if (isGated(millis())) {
+        this->_primed = false;
+        return;
+    }
+    const uint32_t start = micros();
+    const bool onset =
+        this->_detector.process(this->_buffers[this->_index], FRAME_SIZE);
+    this->_busyUs += micros() - start;
+    if (onset) {
+        ESP_LOGI(getName(), "Fired: power %.2e (noise floor: %.2e)",
+                 this->_detector.getPower(), this->_detector.getNoiseFloor());
+        this->_detected = true;
+    }
+    const uint32_t elapsed = millis() - this->_statsStart;
+    if (elapsed >= STATS_INTERVAL_MS) {
+        this->_cpuUsage = this->_busyUs / (elapsed * 10.0f);
+        updateCoreLoad();
+        ESP_LOGI(getName(), "CPU usage: %.2f%% of core %d", this->_cpuUsage,
+                 this->_core);
+        for (size_t i = 0; i < N_CORES; ++i) {
+            ESP_LOGI(getName(), "Core %d load: %.1f%%", i,
+                     this->_coreLoad[i]);
+        }
+        this->_busyUs = 0;
+        this->_statsStart = millis();
+    }
+}
+
+bool MicTrigger::isGated(uint32_t now) {
+    if (this->_echo.isPlaying()) {
+        this->_lastPlaying = now;
+        return true;
+    }
+    return now - this->_lastPlaying < PLAYBACK_HOLDOFF_MS;
+}
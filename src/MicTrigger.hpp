@@ -0,0 +1,163 @@
+#pragma once
+
+#include <Arduino.h>
+#include <esp_log.h>
+
+#include <array>
+
+#include "AtomEcho.hpp"
+#include "ToneDetector.hpp"
+#include "Triggerable.hpp"
+
+/*
+ * Atom Echoの内蔵マイクでお賽銭が落ちた音を検出するトリガー
+ * 専用のタスクで録音と検出を続け，検出したことをisTriggered()で返します。
+ * 自分で音を再生している間と再生が終わった直後は検出しません。
+ */
+class MicTrigger : public Triggerable {
+public:
+    /* サンプリング周波数（Hz） */
+    static constexpr uint32_t SAMPLE_RATE = 16000;
+    /* 1フレームのサンプル数（16ミリ秒） */
+    static constexpr size_t FRAME_SIZE = 256;
+    /* 検出する周波数の数 */
+    static constexpr size_t N_BINS = 3;
+    /* 再生が終わってから検出を再開するまでの時間（ミリ秒） */
+    static constexpr uint32_t PLAYBACK_HOLDOFF_MS = 150;
+    /* CPUのコアの数 */
+    static constexpr size_t N_CORES = portNUM_PROCESSORS;
+    /* CPU使用率をログに出す間隔（ミリ秒） */
+    static constexpr uint32_t STATS_INTERVAL_MS = 10000;
+    /* 検出タスクのスタックサイズ */
+    static constexpr uint32_t TASK_STACK_SIZE = 4096;
+    /* 検出タスクの優先度 */
+    static constexpr UBaseType_t TASK_PRIORITY = 2;
+
+    /*
+     * コンストラクタ
+     *
+     * @param echo Atom Echoのインスタンス
+     * @param core 検出タスクを動かすコア
+     */
+    MicTrigger(AtomEcho& echo, BaseType_t core = 0);
+
+    /*
+     * デストラクタ
+     */
+    virtual ~MicTrigger(void);
+
+    /*
+     * トリガーの名前を返します。
+     *
+     * @return トリガーの名前
+     */
+    virtual const char* getName(void) const;
+
+    /*
+     * 検出タスクを開始します。
+     * Atom Echoを初期化した後に呼ぶこと
+     *
+     * @retval true 初期化が成功した
+     * @retval false 初期化が失敗した
+     */
+    virtual bool begin(void);
+
+    /*
+     * 前回呼び出してから音を検出したかを返します。
+     *
+     * @retval true 音を検出した
+     * @retval false 音を検出していない
+     */
+    virtual bool isTriggered(void);
+
+    /*
+     * トリガーを有効にします。
+     *
+     * @retval true トリガーを有効にできた
+     * @retval false トリガーを有効にできなかった
+     */
+    virtual bool enable(void);
+
+    /*
+     * トリガーを無効にします。
+     *
+     * @retval true トリガーを無効にできた
+     * @retval false トリガーを無効にできなかった
+     */
+    virtual bool disable(void);
+
+    /*
+     * トリガーが有効かどうかを返します。
+     *
+     * @retval true トリガーが有効
+     * @retval false トリガーが無効
+     */
+    virtual bool isEnabled(void);
+
+    /*
+     * 検出処理のCPU使用率を返します。
+     *
+     * @return 検出タスクを動かしているコアに対するCPU使用率（パーセント）
+     */
+    virtual float getCpuUsage(void) const;
+
+    /*
+     * コアの負荷（アイドルタスク以外が動いていた割合）を返します。
+     * マイクの録音はM5Unifiedのタスクが行うため，検出タスクとは別のコアの
+     * 負荷も増えます。
+     *
+     * @param core コアの番号
+     * @return コアの負荷（パーセント）。begin()の前や範囲外のコアでは0
+     */
+    virtual float getCoreLoad(BaseType_t core) const;
+
+protected:
+    /*
+     * 録音と検出を続けるタスク
+     *
+     * @param arg MicTriggerのインスタンス
+     */
+    static void detectionTask(void* arg);
+
+    /*
+     * 録音と検出を1フレーム分進めます。
+     */
+    virtual void step(void);
+
+    /*
+     * ティックの割り込みごとに，実行中のタスクがアイドルタスクかを数えます。
+     */
+    static void countTick(void);
+
+    /*
+     * 前回呼び出してからのコアの負荷を求めます。
+     */
+    void updateCoreLoad(void);
+
+    /*
+     * 自分で音を再生しているため検出を止めるべきかを返します。
+     *
+     * @param now 現在時刻（ミリ秒）
+     * @retval true 検出を止める
+     * @retval false 検出してよい
+     */
+    virtual bool isGated(uint32_t now);
+
+private:
+    AtomEcho& _echo;
+    const BaseType_t _core;
+    ToneDetector<N_BINS> _detector;
+    int16_t _buffers[2][FRAME_SIZE];
+    size_t _index;
+    bool _primed;
+    volatile bool _enabled;
+    volatile bool _detected;
+    uint32_t _lastPlaying;
+    TaskHandle_t _task;
+    uint32_t _busyUs;
+    uint32_t _statsStart;
+    volatile float _cpuUsage;
+    std::array<uint32_t, N_CORES> _lastTicks;
+    std::array<uint32_t, N_CORES> _lastIdleTicks;
+    std::array<volatile float, N_CORES> _coreLoad;
+};
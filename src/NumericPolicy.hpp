@@ -0,0 +1,102 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * 整数（固定小数点）で計算する数値ポリシー
+ * ESP32のFPUは単精度しか扱えないため，倍精度の比率（マージン，測定精度）を
+ * 整数に変換して計算します。比率はQ16（1.0 = 65536）で表します。
+ */
+struct FixedPointPolicy
+{
+    /* 比率の型（Q16） */
+    typedef uint32_t ratio_t;
+
+    /* 比率の小数部のビット数 */
+    static constexpr uint8_t FRACTION_BITS = 16;
+    /* 比率の1.0 */
+    static constexpr ratio_t ONE = static_cast<ratio_t>(1) << FRACTION_BITS;
+
+    /*
+     * 比率を変換します。
+     *
+     * @param r 比率（0.0-1.0）
+     * @return Q16の比率
+     */
+    static inline ratio_t ratio(double r) {
+        return static_cast<ratio_t>(r * ONE + 0.5);
+    }
+
+    /*
+     * v * (1 + r)を四捨五入して返します。
+     *
+     * @param v 値
+     * @param r 比率
+     * @return v * (1 + r)
+     */
+    template <class T>
+    static inline T scaleUp(T v, ratio_t r) {
+        return static_cast<T>(
+            (static_cast<uint32_t>(v) * (ONE + r) + (ONE >> 1)) >>
+            FRACTION_BITS);
+    }
+
+    /*
+     * v * (1 - r)を四捨五入して返します。
+     *
+     * @param v 値
+     * @param r 比率
+     * @return v * (1 - r)
+     */
+    template <class T>
+    static inline T scaleDown(T v, ratio_t r) {
+        return static_cast<T>(
+            (static_cast<uint32_t>(v) * (ONE - r) + (ONE >> 1)) >>
+            FRACTION_BITS);
+    }
+};
+
+/*
+ * 単精度浮動小数点数で計算する数値ポリシー
+ * FixedPointPolicyとの比較用です（FLOAT_POLICYを定義してビルドする）。
+ */
+struct FloatPolicy
+{
+    /* 比率の型 */
+    typedef float ratio_t;
+
+    /*
+     * 比率を変換します。
+     *
+     * @param r 比率（0.0-1.0）
+     * @return 比率
+     */
+    static inline ratio_t ratio(double r) {
+        return static_cast<ratio_t>(r);
+    }
+
+    /*
+     * v * (1 + r)を四捨五入して返します。
+     *
+     * @param v 値
+     * @param r 比率
+     * @return v * (1 + r)
+     */
+    template <class T>
+    static inline T scaleUp(T v, ratio_t r) {
+        return static_cast<T>(v * (1.0f + r) + 0.5f);
+    }
+
+    /*
+     * v * (1 - r)を四捨五入して返します。
+     *
+     * @param v 値
+     * @param r 比率
+     * @return v * (1 - r)
+     */
+    template <class T>
+    static inline T scaleDown(T v, ratio_t r) {
+        return static_cast<T>(v * (1.0f - r) + 0.5f);
+    }
+};
@@ -0,0 +1,303 @@
+#include "OfferingCounter.hpp"
+
+#include <esp_rom_crc.h>
+#include <esp_system.h>
+#include <stddef.h>
+#include <string.h>
+
+/* ヘッダーのサイズ */
+static constexpr size_t HEADER_SIZE = offsetof(offering_counts_t, total);
+/* 1日の秒数 */
+static constexpr time_t SECONDS_PER_DAY = 24 * 60 * 60;
+/* 1時間の秒数 */
+static constexpr time_t SECONDS_PER_HOUR = 60 * 60;
+
+/* ソフトウェアリセットでは消えない記録 */
+static RTC_NOINIT_ATTR offering_counts_t rtcCounts;
+
+OfferingCounter* OfferingCounter::_instance = nullptr;
+
+OfferingCounter::OfferingCounter(const char* ns, const char* key,
+                                 int32_t utcOffset, BaseType_t core)
+    : _namespace(ns),
+      _key(key),
+      _utcOffset(utcOffset),
+      _core(core),
+      _lock(portMUX_INITIALIZER_UNLOCKED),
+      _task(nullptr),
+      _commitLock(nullptr),
+      _pending(0),
+      _lastCommit(0),
+      _stats{} {
+}
+
+OfferingCounter::~OfferingCounter(void) {
+    if (this->_task != nullptr) {
+        vTaskDelete(this->_task);
+        this->_task = nullptr;
+    }
+    if (this->_commitLock != nullptr) {
+        vSemaphoreDelete(this->_commitLock);
+        this->_commitLock = nullptr;
+    }
+    if (_instance == this) {
+        esp_unregister_shutdown_handler(onShutdown);
+        _instance = nullptr;
+    }
+    this->_prefs.end();
+}
+
+bool OfferingCounter::begin(void) {
+    if (_instance != nullptr) {
+        ESP_LOGE("Counter", "Already started");
+        return false;
+    }
+    if (!this->_prefs.begin(this->_namespace, false)) {
+        ESP_LOGE("Counter", "Failed to initialize %s", this->_namespace);
+        return false;
+    }
+    this->_commitLock = xSemaphoreCreateMutex();
+    if (this->_commitLock == nullptr) {
+        ESP_LOGE("Counter", "Failed to create mutex");
+        return false;
+    }
+
+    offering_counts_t stored;
+    if (!load(stored)) {
+        memset(&stored, 0, sizeof(stored));
+        seal(stored);
+    }
+    const esp_reset_reason_t reason = esp_reset_reason();
+    if (reason != ESP_RST_POWERON && isValid(rtcCounts) &&
+        rtcCounts.total >= stored.total) {
+        this->_pending = rtcCounts.total - stored.total;
+        ESP_LOGI("Counter", "Restored from RTC memory: %d (pending: %d)",
+                 rtcCounts.total, this->_pending);
+    } else {
+        rtcCounts = stored;
+        this->_pending = 0;
+        ESP_LOGI("Counter", "Restored from NVS: %d", rtcCounts.total);
+    }
+
+    _instance = this;
+    esp_register_shutdown_handler(onShutdown);
+    this->_lastCommit = millis();
+    if (reason == ESP_RST_BROWNOUT && this->_pending > 0) {
+        ESP_LOGW("Counter", "Brownout detected, committing");
+        commit();
+    }
+    if (xTaskCreatePinnedToCore(commitTask, "counter", TASK_STACK_SIZE, this,
+                                TASK_PRIORITY, &this->_task,
+                                this->_core) != pdPASS) {
+        ESP_LOGE("Counter", "Failed to create task");
+        this->_task = nullptr;
+        return false;
+    }
+    return true;
+}
+
+void OfferingCounter::increment(void) {
+    const time_t now = time(nullptr);
+    portENTER_CRITICAL(&this->_lock);
+    const uint8_t hour = advance(now);
+    ++rtcCounts.total;
+    ++rtcCounts.daily[rtcCounts.day % DAYS];
+    if (rtcCounts.hourly[hour] < UINT16_MAX) {
+        ++rtcCounts.hourly[hour];
+    }
+    seal(rtcCounts);
+    const uint32_t pending = ++(this->_pending);
+    portEXIT_CRITICAL(&this->_lock);
+    if (pending >= COMMIT_COUNT && this->_task != nullptr) {
+        xTaskNotifyGive(this->_task);
+    }
+}
+
+bool OfferingCounter::commit(void) {
+    if (this->_commitLock == nullptr ||
+        xSemaphoreTake(this->_commitLock, pdMS_TO_TICKS(100)) != pdTRUE) {
+        return false;
+    }
+    offering_counts_t snapshot;
+    portENTER_CRITICAL(&this->_lock);
+    snapshot = rtcCounts;
+    const uint32_t pending = this->_pending;
+    portEXIT_CRITICAL(&this->_lock);
+    if (pending == 0) {
+        xSemaphoreGive(this->_commitLock);
+        return true;
+    }
+
+    const uint32_t start = micros();
+    const bool ok = this->_prefs.putBytes(this->_key, &snapshot,
+                                          sizeof(snapshot)) == sizeof(snapshot);
+    const uint32_t elapsed = micros() - start;
+
+    portENTER_CRITICAL(&this->_lock);
+    if (ok) {
+        this->_pending -= pending;
+        ++(this->_stats.commits);
+    } else {
+        ++(this->_stats.failures);
+    }
+    this->_stats.lastUs = elapsed;
+    if (elapsed > this->_stats.maxUs) {
+        this->_stats.maxUs = elapsed;
+    }
+    portEXIT_CRITICAL(&this->_lock);
+    this->_lastCommit = millis();
+    xSemaphoreGive(this->_commitLock);
+
+    if (!ok) {
+        ESP_LOGE("Counter", "Failed to write %s", this->_key);
+    } else if (elapsed > COMMIT_BUDGET_US) {
+        ESP_LOGW("Counter", "Commit took %dus (budget: %dus)", elapsed,
+                 COMMIT_BUDGET_US);
+    } else {
+        ESP_LOGD("Counter", "Committed %d in %dus", pending, elapsed);
+    }
+    return ok;
+}
+
+void OfferingCounter::getCounts(offering_counts_t& counts) {
+    portENTER_CRITICAL(&this->_lock);
+    counts = rtcCounts;
+    portEXIT_CRITICAL(&this->_lock);
+}
+
+uint32_t OfferingCounter::getTotal(void) {
+    portENTER_CRITICAL(&this->_lock);
+    const uint32_t total = rtcCounts.total;
+    portEXIT_CRITICAL(&this->_lock);
+    return total;
+}
+
+uint32_t OfferingCounter::getPending(void) {
+    portENTER_CRITICAL(&this->_lock);
+    const uint32_t pending = this->_pending;
+    portEXIT_CRITICAL(&this->_lock);
+    return pending;
+}
+
+commit_stats_t OfferingCounter::getStats(void) {
+    portENTER_CRITICAL(&this->_lock);
+    const commit_stats_t stats = this->_stats;
+    portEXIT_CRITICAL(&this->_lock);
+    return stats;
+}
+
+size_t OfferingCounter::printTo(Print& out) {
+    offering_counts_t counts;
+    const time_t now = time(nullptr);
+    portENTER_CRITICAL(&this->_lock);
+    advance(now);
+    seal(rtcCounts);
+    counts = rtcCounts;
+    const uint32_t pending = this->_pending;
+    const commit_stats_t stats = this->_stats;
+    portEXIT_CRITICAL(&this->_lock);
+
+    size_t n = out.printf("{\"total\":%u,\"day\":%u,\"synced\":%s,\"daily\":[",
+                          counts.total, counts.day,
+                          counts.synced ? "true" : "false");
+    // 古い日から順に出力する
+    for (size_t i = 0; i < DAYS; ++i) {
+        const size_t index = (counts.day % DAYS + i + 1) % DAYS;
+        n += out.printf(i == 0 ? "%u" : ",%u", counts.daily[index]);
+    }
+    n += out.print("],\"hourly\":[");
+    for (size_t i = 0; i < HOURS; ++i) {
+        n += out.printf(i == 0 ? "%u" : ",%u", counts.hourly[i]);
+    }
+    n += out.printf(
+        "],\"pending\":%u,\"commits\":%u,\"failures\":%u,"
+        "\"lastCommitUs\":%u,\"maxCommitUs\":%u}\n",
+        pending, stats.commits, stats.failures, stats.lastUs, stats.maxUs);
+    return n;
+}
+
+void OfferingCounter::commitTask(void* arg) {
+    OfferingCounter* self = static_cast<OfferingCounter*>(arg);
+    while (true) {
+        ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(1000));
+        if (self->shouldCommit(millis())) {
+            self->commit();
+        }
+    }
+}
+
+void OfferingCounter::onShutdown(void) {
+    if (_instance != nullptr) {
+        _instance->commit();
+    }
+}
+
+bool OfferingCounter::shouldCommit(uint32_t now) {
+    const uint32_t pending = getPending();
+    const uint32_t elapsed = now - this->_lastCommit;
+    if (pending == 0 || elapsed < MIN_COMMIT_INTERVAL_MS) {
+        return false;
+    }
+    return pending >= COMMIT_COUNT || elapsed >= COMMIT_INTERVAL_MS;
+}
+
+uint8_t OfferingCounter::advance(time_t now) {
+    if (now < MIN_VALID_TIME) {
+        return (millis() / (SECONDS_PER_HOUR * 1000)) % HOURS;
+    }
+    const time_t local = now + this->_utcOffset;
+    const uint32_t day = local / SECONDS_PER_DAY;
+    const uint8_t hour = (local / SECONDS_PER_HOUR) % HOURS;
+    if (!rtcCounts.synced) {
+        // 時刻が設定されるまでの回数は，設定された日の回数とする
+        const uint32_t today = rtcCounts.daily[rtcCounts.day % DAYS];
+        memset(rtcCounts.daily, 0, sizeof(rtcCounts.daily));
+        rtcCounts.daily[day % DAYS] = today;
+        rtcCounts.day = day;
+        rtcCounts.synced = 1;
+    } else if (day > rtcCounts.day) {
+        const uint32_t gap = day - rtcCounts.day;
+        for (uint32_t i = 1; i <= gap && i <= DAYS; ++i) {
+            rtcCounts.daily[(rtcCounts.day + i) % DAYS] = 0;
+        }
+        memset(rtcCounts.hourly, 0, sizeof(rtcCounts.hourly));
+        rtcCounts.day = day;
+    }
+    return hour;
+}
+
+void OfferingCounter::seal(offering_counts_t& counts) {
+    counts.version = VERSION;
+    counts.size = sizeof(offering_counts_t);
+    counts.checksum =
+        esp_rom_crc32_le(0, reinterpret_cast<const uint8_t*>(&counts) +
+                                HEADER_SIZE,
+                         sizeof(offering_counts_t) - HEADER_SIZE);
+}
+
+bool OfferingCounter::isValid(const offering_counts_t& counts) {
+    if (counts.version != VERSION || counts.size != sizeof(offering_counts_t)) {
+        return false;
+    }
+    return counts.checksum ==
+           esp_rom_crc32_le(0, reinterpret_cast<const uint8_t*>(&counts) +
+                                   HEADER_SIZE,
+                            sizeof(offering_counts_t) - HEADER_SIZE);
+}
+
+bool OfferingCounter::load(offering_counts_t& counts) {
+    const size_t len = this->_prefs.getBytesLength(this->_key);
+    if (len == 0) {
+        return false;
+    }
+    if (len != sizeof(offering_counts_t) ||
+        this->_prefs.getBytes(this->_key, &counts, len) != len) {
+        ESP_LOGE("Counter", "Failed to read %s (%d bytes)", this->_key, len);
+        return false;
+    }
+    if (!isValid(counts)) {
+        ESP_LOGE("Counter", "Checksum mismatch");
+        return false;
+    }
+    return true;
+}
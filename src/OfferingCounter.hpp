@@ -0,0 +1,228 @@
+#pragma once
+
+#include <Arduino.h>
+#include <Preferences.h>
+#include <esp_log.h>
+#include <freertos/semphr.h>
+#include <time.h>
+
+/*
+ * お賽銭の回数の記録
+ * RTCメモリとNVSに同じ形式で保存します。
+ * フィールドは末尾にのみ追加すること（古いバージョンのデータを読めるように）
+ */
+struct __attribute__((packed)) offering_counts_t
+{
+    /* ---- ヘッダー ---- */
+    /* 記録のバージョン */
+    uint16_t version;
+    /* 記録全体のサイズ（バイト） */
+    uint16_t size;
+    /* ヘッダー以降のCRC32 */
+    uint32_t checksum;
+    /* ---- version 1 ---- */
+    /* 累計の回数 */
+    uint32_t total;
+    /* 今日の日付（1970年1月1日からの日数）。時刻が未設定の場合は0 */
+    uint32_t day;
+    /* 日ごとの回数（day % 7番目が今日） */
+    uint32_t daily[7];
+    /* 今日の1時間ごとの回数 */
+    uint16_t hourly[24];
+    /* 時刻が設定されてから記録したか */
+    uint8_t synced;
+};
+
+/*
+ * NVSへの書き込みの統計
+ */
+struct commit_stats_t
+{
+    /* 書き込んだ回数 */
+    uint32_t commits;
+    /* 書き込みに失敗した回数 */
+    uint32_t failures;
+    /* 最後の書き込みにかかった時間（マイクロ秒） */
+    uint32_t lastUs;
+    /* 最も長くかかった書き込みの時間（マイクロ秒） */
+    uint32_t maxUs;
+};
+
+/*
+ * お賽銭の回数を数えて保存するクラス
+ * 回数はRTCメモリで数えるため，ソフトウェアリセットでは消えません。
+ * NVSへは一定の回数または時間ごとにまとめて書き込み，フラッシュの摩耗と
+ * 消去待ちで測定が止まることを防ぎます。書き込みは専用のタスクで行います。
+ * RTCメモリは1つしかないため，インスタンスは1つだけ作ること
+ */
+class OfferingCounter {
+public:
+    /* 現在の記録のバージョン */
+    static constexpr uint16_t VERSION = 1;
+    /* 記録する日数 */
+    static constexpr size_t DAYS = 7;
+    /* 1日の時間数 */
+    static constexpr size_t HOURS = 24;
+    /* この回数がたまったらNVSに書き込む */
+    static constexpr uint32_t COMMIT_COUNT = 32;
+    /* 最後に書き込んでからこの時間（ミリ秒）が経ったらNVSに書き込む */
+    static constexpr uint32_t COMMIT_INTERVAL_MS = 15 * 60 * 1000;
+    /* NVSに書き込む最短の間隔（ミリ秒） */
+    static constexpr uint32_t MIN_COMMIT_INTERVAL_MS = 60 * 1000;
+    /* 書き込みにかかる時間の目安（マイクロ秒）。超えると警告する */
+    static constexpr uint32_t COMMIT_BUDGET_US = 50000;
+    /* 時刻が設定されているとみなす最小のUNIX時間（2023年1月1日） */
+    static constexpr time_t MIN_VALID_TIME = 1672531200;
+    /* 書き込みタスクのスタックサイズ */
+    static constexpr uint32_t TASK_STACK_SIZE = 4096;
+    /* 書き込みタスクの優先度 */
+    static constexpr UBaseType_t TASK_PRIORITY = 1;
+
+    /*
+     * コンストラクタ
+     *
+     * @param ns NVSの名前空間（15文字以内）
+     * @param key 記録を保存するキー（15文字以内）
+     * @param utcOffset UTCとの時差（秒）。デフォルトは日本時間
+     * @param core 書き込みタスクを動かすコア
+     */
+    OfferingCounter(const char* ns, const char* key,
+                    int32_t utcOffset = 9 * 60 * 60, BaseType_t core = 0);
+
+    /*
+     * デストラクタ
+     */
+    virtual ~OfferingCounter(void);
+
+    /*
+     * 記録を復元し，書き込みタスクを開始します。
+     * ソフトウェアリセットの後はRTCメモリから，電源投入後はNVSから復元します。
+     * ブラウンアウトによるリセットの後は，復元した記録をすぐに書き込みます。
+     *
+     * @retval true 初期化が成功した
+     * @retval false 初期化が失敗した
+     */
+    virtual bool begin(void);
+
+    /*
+     * 回数を1つ増やします。
+     * 時間がかからないため，どのタスクからでも呼べます。
+     */
+    virtual void increment(void);
+
+    /*
+     * 記録をすぐにNVSへ書き込みます。
+     *
+     * @retval true 書き込めた（書き込む必要がなかった）
+     * @retval false 書き込めなかった
+     */
+    virtual bool commit(void);
+
+    /*
+     * 記録の写しを返します。
+     *
+     * @param counts 記録の写し
+     */
+    virtual void getCounts(offering_counts_t& counts);
+
+    /*
+     * 累計の回数を返します。
+     *
+     * @return 累計の回数
+     */
+    virtual uint32_t getTotal(void);
+
+    /*
+     * NVSにまだ書き込んでいない回数を返します。
+     *
+     * @return 書き込んでいない回数
+     */
+    virtual uint32_t getPending(void);
+
+    /*
+     * NVSへの書き込みの統計を返します。
+     *
+     * @return 書き込みの統計
+     */
+    virtual commit_stats_t getStats(void);
+
+    /*
+     * 記録をJSONの1行で出力します。
+     *
+     * @param out 出力先
+     * @return 出力したバイト数
+     */
+    virtual size_t printTo(Print& out);
+
+protected:
+    /*
+     * 書き込みの条件を満たしたらNVSに書き込むタスク
+     *
+     * @param arg OfferingCounterのインスタンス
+     */
+    static void commitTask(void* arg);
+
+    /*
+     * 再起動の直前に呼ばれ，記録をNVSに書き込みます。
+     */
+    static void onShutdown(void);
+
+    /*
+     * NVSに書き込むべきかを返します。
+     *
+     * @param now 現在時刻（ミリ秒）
+     * @retval true 書き込むべき
+     * @retval false まだ書き込まなくてよい
+     */
+    virtual bool shouldCommit(uint32_t now);
+
+    /*
+     * 現在の日付に合わせて記録を進めます。_lockを取ってから呼ぶこと
+     * 時刻が設定されていない間は日付を進めず，起動してからの時間で
+     * 1時間ごとの回数を数えます。
+     *
+     * @param now 現在のUNIX時間
+     * @return 1時間ごとの回数のうち，現在の時間の位置
+     */
+    virtual uint8_t advance(time_t now);
+
+    /*
+     * 記録のヘッダーを設定します。
+     *
+     * @param counts 記録
+     */
+    static void seal(offering_counts_t& counts);
+
+    /*
+     * 記録が壊れていないかを返します。
+     *
+     * @param counts 記録
+     * @retval true 壊れていない
+     * @retval false 壊れている
+     */
+    static bool isValid(const offering_counts_t& counts);
+
+    /*
+     * NVSから記録を読み込みます。
+     *
+     * @param counts 記録
+     * @retval true 読み込めた
+     * @retval false 保存されていない，もしくは壊れていた
+     */
+    virtual bool load(offering_counts_t& counts);
+
+private:
+    static OfferingCounter* _instance;
+
+    Preferences _prefs;
+    const char* _namespace;
+    const char* _key;
+    const int32_t _utcOffset;
+    const BaseType_t _core;
+    portMUX_TYPE _lock;
+    TaskHandle_t _task;
+    SemaphoreHandle_t _commitLock;
+    uint32_t _pending;
+    uint32_t _lastCommit;
+    commit_stats_t _stats;
+};
@@ -0,0 +1,259 @@
+#pragma once
+
+#include <Arduino.h>
+#include <esp_log.h>
+
+/*
+ * イベントの種類
+ */
+enum trigger_event_kind_t
+{
+    /* トリガーが発火した */
+    TRIGGER_EVENT_FIRED,
+    /* まもなく発火すると予測した。外れた場合はReaction::cancel()が呼ばれる */
+    TRIGGER_EVENT_PREDICTED,
+    /*
+     * 予測した通りに発火したが，ほかのトリガーの発火とまとめたため
+     * TRIGGER_EVENT_FIREDは発行しなかった
+     */
+    TRIGGER_EVENT_CONFIRMED,
+};
+
+/*
+ * トリガーの発火を表すイベント
+ */
+struct trigger_event_t
+{
+    /* 発火したトリガーの名前 */
+    const char* source;
+    /* 発火した時刻（ミリ秒） */
+    uint32_t timestamp;
+    /* 通し番号 */
+    uint32_t sequence;
+    /* イベントの種類 */
+    trigger_event_kind_t kind;
+};
+
+/*
+ * リアクションの優先度
+ */
+enum reaction_priority_t
+{
+    /* すぐに終わるリアクション（LED，カウンターなど） */
+    REACTION_PRIORITY_HIGH,
+    /* 時間がかかるリアクション（音など） */
+    REACTION_PRIORITY_NORMAL,
+    /* 遅れてもよいリアクション（ログなど） */
+    REACTION_PRIORITY_LOW,
+    REACTION_PRIORITY_COUNT,
+};
+
+/*
+ * リアクションが失敗したときの扱い
+ */
+enum reaction_error_policy_t
+{
+    /* 記録だけして次のイベントも処理する */
+    REACTION_IGNORE,
+    /* 1回だけやり直す */
+    REACTION_RETRY,
+    /* 続けて失敗したらリアクションを無効にする */
+    REACTION_DISABLE,
+};
+
+/*
+ * リアクションの実行結果の統計
+ */
+struct reaction_stats_t
+{
+    /* 実行した回数 */
+    uint32_t runs;
+    /* 失敗した回数 */
+    uint32_t failures;
+    /* 続けて失敗した回数 */
+    uint32_t consecutiveFailures;
+    /* 持ち時間を超えた回数 */
+    uint32_t overruns;
+    /* 最長の実行時間（ミリ秒） */
+    uint32_t maxElapsed;
+    /* イベントの発生から実行開始までの最長の遅れ（ミリ秒） */
+    uint32_t maxLatency;
+};
+
+/*
+ * トリガーの発火に対するリアクションを表す
+ * 1回の実行には持ち時間があります。時間のかかるリアクションは，react()の
+ * 中でgetRemainingBudget()を見て，持ち時間を使い切ったら途中で打ち切ること
+ */
+class Reaction {
+public:
+    /* REACTION_DISABLEのときに無効にする連続失敗回数 */
+    static constexpr uint32_t MAX_CONSECUTIVE_FAILURES = 3;
+
+    /*
+     * コンストラクタ
+     *
+     * @param priority 優先度
+     * @param budget 1回の実行の持ち時間（ミリ秒）。やり直しの分も含む
+     * @param policy 失敗したときの扱い
+     */
+    Reaction(reaction_priority_t priority, uint32_t budget,
+             reaction_error_policy_t policy)
+        : _priority(priority),
+          _budget(budget),
+          _policy(policy),
+          _enabled(true),
+          _startedAt(0),
+          _stats{} {
+    }
+
+    /*
+     * デストラクタ
+     */
+    virtual ~Reaction(void) {
+    }
+
+    /*
+     * リアクションの名前を返します。
+     *
+     * @return リアクションの名前
+     */
+    virtual const char* getName(void) const = 0;
+
+    /*
+     * イベントに対してリアクションを実行し，失敗したときの扱いに従って
+     * 統計を更新します。持ち時間を使い切った実行は，打ち切ったかどうかに
+     * かかわらず持ち時間を超えた回数に数えます。
+     *
+     * @param event イベント
+     * @retval true リアクションが成功した
+     * @retval false リアクションが失敗した，もしくは無効になっている
+     */
+    bool run(const trigger_event_t& event) {
+        if (!this->_enabled) {
+            return false;
+        }
+        const uint32_t start = millis();
+        const uint32_t latency = start - event.timestamp;
+        this->_startedAt = start;
+        bool ok = react(event);
+        if (!ok && this->_policy == REACTION_RETRY &&
+            getRemainingBudget() > 0) {
+            ESP_LOGW(getName(), "Retrying event #%d", event.sequence);
+            ok = react(event);
+        }
+        const uint32_t elapsed = millis() - start;
+        ++(this->_stats.runs);
+        if (latency > this->_stats.maxLatency) {
+            this->_stats.maxLatency = latency;
+        }
+        if (elapsed > this->_stats.maxElapsed) {
+            this->_stats.maxElapsed = elapsed;
+        }
+        if (elapsed >= this->_budget) {
+            ++(this->_stats.overruns);
+            ESP_LOGW(getName(), "Over budget: %dms(budget: %dms)", elapsed,
+                     this->_budget);
+        }
+        if (ok) {
+            this->_stats.consecutiveFailures = 0;
+            return true;
+        }
+        ++(this->_stats.failures);
+        ++(this->_stats.consecutiveFailures);
+        ESP_LOGE(getName(), "Failed to react to event #%d (%d/%d)",
+                 event.sequence, this->_stats.failures, this->_stats.runs);
+        if (this->_policy == REACTION_DISABLE &&
+            this->_stats.consecutiveFailures >= MAX_CONSECUTIVE_FAILURES) {
+            ESP_LOGE(getName(), "Disabled");
+            this->_enabled = false;
+        }
+        return false;
+    }
+
+    /*
+     * イベントを受け取るかを返します。
+     * デフォルトでは発火したイベントのみを受け取ります。
+     *
+     * @param event イベント
+     * @retval true 受け取る
+     * @retval false 受け取らない
+     */
+    virtual bool accepts(const trigger_event_t& event) const {
+        return event.kind == TRIGGER_EVENT_FIRED;
+    }
+
+    /*
+     * 予測が外れたときに，TRIGGER_EVENT_PREDICTEDに対するリアクションを
+     * 取り消します。発行したタスクから直接呼ばれるため，すぐに戻ること
+     *
+     * @param event 取り消しを表すイベント
+     */
+    virtual void cancel(const trigger_event_t& event) {
+    }
+
+    /*
+     * 優先度を返します。
+     *
+     * @return 優先度
+     */
+    inline reaction_priority_t getPriority(void) const {
+        return this->_priority;
+    }
+
+    /*
+     * リアクションが有効かどうかを返します。
+     *
+     * @retval true リアクションが有効
+     * @retval false 失敗が続いたため無効になっている
+     */
+    inline bool isEnabled(void) const {
+        return this->_enabled;
+    }
+
+    /*
+     * リアクションを有効にし，連続失敗回数を消します。
+     */
+    void enable(void) {
+        this->_stats.consecutiveFailures = 0;
+        this->_enabled = true;
+    }
+
+    /*
+     * 実行結果の統計を返します。
+     *
+     * @return 実行結果の統計
+     */
+    inline const reaction_stats_t& getStats(void) const {
+        return this->_stats;
+    }
+
+protected:
+    /*
+     * イベントに対するリアクションを実行します。
+     * getRemainingBudget()より長くかかる処理は途中で打ち切ること
+     *
+     * @param event イベント
+     * @retval true リアクションが成功した
+     * @retval false リアクションが失敗した
+     */
+    virtual bool react(const trigger_event_t& event) = 0;
+
+    /*
+     * 実行中のリアクションの残りの持ち時間を返します。react()の中で呼ぶこと
+     *
+     * @return 残りの持ち時間（ミリ秒）。使い切っていれば0
+     */
+    uint32_t getRemainingBudget(void) const {
+        const uint32_t elapsed = millis() - this->_startedAt;
+        return elapsed < this->_budget ? this->_budget - elapsed : 0;
+    }
+
+private:
+    const reaction_priority_t _priority;
+    const uint32_t _budget;
+    const reaction_error_policy_t _policy;
+    volatile bool _enabled;
+    uint32_t _startedAt;
+    reaction_stats_t _stats;
+};
@@ -0,0 +1,223 @@
+#pragma once
+
+#include <Arduino.h>
+#include <esp_log.h>
+#include <freertos/queue.h>
+
+#include <array>
+
+#include "Reaction.hpp"
+
+/*
+ * トリガーの発火イベントを登録したリアクションに配るクラス
+ * 優先度ごとにキューと実行タスクを持つため，時間のかかるリアクションが
+ * ほかのリアクションや距離の測定を待たせることはありません。
+ * キューがいっぱいの場合，イベントは待たずに捨てます。
+ *
+ * @param MAX_REACTIONS 登録できるリアクションの最大数
+ * @param QUEUE_LENGTH リアクション1つあたりのキューの長さ
+ */
+template <std::size_t MAX_REACTIONS = 8, std::size_t QUEUE_LENGTH = 4>
+class ReactionDispatcher {
+public:
+    /* 実行タスクのスタックサイズ */
+    static constexpr uint32_t TASK_STACK_SIZE = 6144;
+    /* 優先度が最も高い実行タスクのFreeRTOSでの優先度 */
+    static constexpr UBaseType_t TASK_PRIORITY_HIGH = 3;
+
+    /*
+     * コンストラクタ
+     *
+     * @param core 実行タスクを動かすコア
+     */
+    ReactionDispatcher(BaseType_t core = 0)
+        : _core(core),
+          _started(false),
+          _size(0),
+          _reactions{},
+          _workers{},
+          _sequence(0),
+          _dropped(0) {
+    }
+
+    /*
+     * デストラクタ
+     * 登録したリアクションは削除しません。
+     */
+    virtual ~ReactionDispatcher(void) {
+    }
+
+    /*
+     * リアクションを登録します。begin()の前に呼ぶこと
+     *
+     * @param reaction 登録するリアクション
+     * @retval true 登録できた
+     * @retval false 登録できなかった
+     */
+    virtual bool add(Reaction* reaction) {
+        if (reaction == nullptr || this->_started ||
+            this->_size >= MAX_REACTIONS) {
+            ESP_LOGE("Dispatcher", "Failed to add reaction");
+            return false;
+        }
+        this->_reactions[this->_size++] = reaction;
+        return true;
+    }
+
+    /*
+     * 登録したリアクションの優先度ごとにキューと実行タスクを作ります。
+     *
+     * @retval true 初期化が成功した
+     * @retval false 初期化が失敗した
+     */
+    virtual bool begin(void) {
+        if (this->_started) {
+            return true;
+        }
+        for (std::size_t p = 0; p < REACTION_PRIORITY_COUNT; ++p) {
+            worker_t& w = this->_workers[p];
+            w.dispatcher = this;
+            w.priority = static_cast<reaction_priority_t>(p);
+            std::size_t n = 0;
+            for (std::size_t i = 0; i < this->_size; ++i) {
+                if (this->_reactions[i]->getPriority() == w.priority) {
+                    ++n;
+                }
+            }
+            if (n == 0) {
+                continue;
+            }
+            w.queue = xQueueCreate(n * QUEUE_LENGTH, sizeof(job_t));
+            if (w.queue == nullptr) {
+                ESP_LOGE("Dispatcher", "Failed to create queue %d", p);
+                return false;
+            }
+            if (xTaskCreatePinnedToCore(workerTask, getTaskName(w.priority),
+                                        TASK_STACK_SIZE, &w,
+                                        TASK_PRIORITY_HIGH - p, &w.task,
+                                        this->_core) != pdPASS) {
+                ESP_LOGE("Dispatcher", "Failed to create task %d", p);
+                return false;
+            }
+        }
+        this->_started = true;
+        return true;
+    }
+
+    /*
+     * イベントを発行します。待たずに戻ります。
+     *
+     * @param source 発火したトリガーの名前
+     * @param kind イベントの種類
+     * @retval true すべてのリアクションのキューに入れた
+     * @retval false キューがいっぱいで捨てたリアクションがある
+     */
+    virtual bool publish(const char* source,
+                         trigger_event_kind_t kind = TRIGGER_EVENT_FIRED) {
+        if (!this->_started) {
+            return false;
+        }
+        job_t job;
+        job.event = {source, millis(), ++(this->_sequence), kind};
+        bool ok = true;
+        for (std::size_t i = 0; i < this->_size; ++i) {
+            job.reaction = this->_reactions[i];
+            if (!job.reaction->isEnabled() ||
+                !job.reaction->accepts(job.event)) {
+                continue;
+            }
+            const worker_t& w = this->_workers[job.reaction->getPriority()];
+            if (xQueueSend(w.queue, &job, 0) != pdTRUE) {
+                ++(this->_dropped);
+                ok = false;
+                ESP_LOGW("Dispatcher", "Dropped event #%d for %s",
+                         job.event.sequence, job.reaction->getName());
+            }
+        }
+        return ok;
+    }
+
+    /*
+     * 予測が外れたことを，予測のイベントを受け取るリアクションに伝えます。
+     * リアクションのcancel()を呼び出したタスクで直接実行します。
+     *
+     * @param source 予測したトリガーの名前
+     */
+    virtual void cancel(const char* source) {
+        if (!this->_started) {
+            return;
+        }
+        const trigger_event_t event = {source, millis(), ++(this->_sequence),
+                                       TRIGGER_EVENT_PREDICTED};
+        for (std::size_t i = 0; i < this->_size; ++i) {
+            if (this->_reactions[i]->accepts(event)) {
+                this->_reactions[i]->cancel(event);
+            }
+        }
+    }
+
+    /*
+     * キューがいっぱいで捨てたイベントの数を返します。
+     *
+     * @return 捨てたイベントの数
+     */
+    inline uint32_t getDropped(void) const {
+        return this->_dropped;
+    }
+
+protected:
+    struct job_t
+    {
+        Reaction* reaction;
+        trigger_event_t event;
+    };
+
+    struct worker_t
+    {
+        ReactionDispatcher* dispatcher;
+        reaction_priority_t priority;
+        QueueHandle_t queue;
+        TaskHandle_t task;
+    };
+
+    /*
+     * 優先度ごとの実行タスクの名前を返します。
+     *
+     * @param priority 優先度
+     * @return 実行タスクの名前
+     */
+    static const char* getTaskName(reaction_priority_t priority) {
+        switch (priority) {
+            case REACTION_PRIORITY_HIGH:
+                return "reaction-high";
+            case REACTION_PRIORITY_LOW:
+                return "reaction-low";
+            default:
+                return "reaction";
+        }
+    }
+
+    /*
+     * キューからイベントを取り出してリアクションを実行するタスク
+     *
+     * @param arg worker_tのインスタンス
+     */
+    static void workerTask(void* arg) {
+        worker_t* w = static_cast<worker_t*>(arg);
+        job_t job;
+        while (true) {
+            if (xQueueReceive(w->queue, &job, portMAX_DELAY) == pdTRUE) {
+                job.reaction->run(job.event);
+            }
+        }
+    }
+
+private:
+    const BaseType_t _core;
+    bool _started;
+    std::size_t _size;
+    std::array<Reaction*, MAX_REACTIONS> _reactions;
+    std::array<worker_t, REACTION_PRIORITY_COUNT> _workers;
+    uint32_t _sequence;
+    uint32_t _dropped;
+};
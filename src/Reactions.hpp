@@ -0,0 +1,302 @@
+#pragma once
+
+#include <FS.h>
+#include <esp_log.h>
+
+#include <atomic>
+
+#include "AtomEcho.hpp"
+#include "OfferingCounter.hpp"
+#include "Reaction.hpp"
+
+/*
+ * リアクションが使う資源（ファイルシステムなど）の状態
+ */
+enum resource_state_t
+{
+    /* 使える */
+    RESOURCE_READY,
+    /* まだ準備中（今回は使わずに見送る） */
+    RESOURCE_PENDING,
+    /* 準備に失敗した */
+    RESOURCE_FAILED,
+};
+
+/*
+ * WAVファイルを再生するリアクション
+ */
+class SoundReaction : public Reaction {
+public:
+    /* 1回の再生の持ち時間（ミリ秒） */
+    static constexpr uint32_t DEFAULT_BUDGET_MS = 10000;
+
+    /*
+     * コンストラクタ
+     *
+     * @param echo Atom Echoのインスタンス
+     * @param fs ファイルが置いてあるファイルシステム
+     * @param filename 再生するWAVファイル名
+     * @param ready ファイルシステムの状態を返す関数。不要ならnullptr
+     *              待つ場合は時間を区切り，間に合わなければRESOURCE_PENDINGを
+     *              返すこと
+     */
+    SoundReaction(AtomEcho& echo, FS& fs, const char* filename,
+                  resource_state_t (*ready)(void) = nullptr)
+        : Reaction(REACTION_PRIORITY_NORMAL, DEFAULT_BUDGET_MS,
+                   REACTION_DISABLE),
+          _echo(echo),
+          _fs(fs),
+          _filename(filename),
+          _ready(ready),
+          _preStarted(false),
+          _cancelled(0) {
+    }
+
+    /*
+     * デストラクタ
+     */
+    virtual ~SoundReaction(void) {
+    }
+
+    /*
+     * リアクションの名前を返します。
+     *
+     * @return リアクションの名前
+     */
+    virtual const char* getName(void) const {
+        return "Sound";
+    }
+
+    /*
+     * 再生するWAVファイルを開いておきます。
+     * 再生のたびにファイルを開かないため，発火してからヒープを確保しません。
+     * ファイルシステムが使えるようになってから呼ぶこと
+     *
+     * @retval true 開けた
+     * @retval false 開けなかった
+     */
+    bool prepare(void) {
+        return this->_echo.openWav(this->_fs, this->_filename);
+    }
+
+    /*
+     * 予測のイベントでは先に再生を始めるため，予測と確定のイベントも
+     * 受け取ります。
+     */
+    virtual bool accepts(const trigger_event_t& event) const {
+        return true;
+    }
+
+    /*
+     * 予測で始めた再生を止めます。
+     * react()とは別のタスクから呼ばれます。react()が_preStartedを立ててから
+     * _cancelledを読むのに対し，こちらは_cancelledを書いてから_preStartedを
+     * 読むため，どちらかが必ず相手の書き込みを見ます。
+     */
+    virtual void cancel(const trigger_event_t& event) {
+        this->_cancelled.store(event.sequence);
+        if (this->_preStarted.exchange(false)) {
+            this->_echo.stopWav();
+        }
+    }
+
+protected:
+    virtual bool react(const trigger_event_t& event) {
+        if (event.kind == TRIGGER_EVENT_CONFIRMED) {
+            // 予測で始めた再生をそのまま続け，次の発火のイベントでは鳴らす
+            this->_preStarted.store(false);
+            return true;
+        }
+        // 取り消しを調べる前に取っておき，調べた後にstopWav()が呼ばれても
+        // 再生しないようにする
+        const uint32_t generation = this->_echo.getStopGeneration();
+        if (event.kind == TRIGGER_EVENT_PREDICTED) {
+            this->_preStarted.store(true);
+            if (event.sequence < this->_cancelled.load()) {
+                // キューで待っている間に取り消された
+                this->_preStarted.store(false);
+                return true;
+            }
+        } else if (this->_preStarted.exchange(false)) {
+            // 予測で再生を始めていた
+            return true;
+        }
+        const resource_state_t state =
+            this->_ready != nullptr ? this->_ready() : RESOURCE_READY;
+        if (state == RESOURCE_PENDING) {
+            // 起動直後でまだマウントが終わっていない。失敗とは数えない
+            ESP_LOGW(getName(), "Storage is not ready, skipped #%d",
+                     event.sequence);
+            this->_preStarted.store(false);
+            return true;
+        }
+        if (state == RESOURCE_FAILED) {
+            this->_preStarted.store(false);
+            return false;
+        }
+        // 持ち時間を超えそうなら再生を途中で止める
+        const bool ok = this->_echo.playWav(this->_fs, this->_filename,
+                                            getRemainingBudget(), generation);
+        if (!ok) {
+            this->_preStarted.store(false);
+        }
+        return ok;
+    }
+
+private:
+    AtomEcho& _echo;
+    FS& _fs;
+    const char* _filename;
+    resource_state_t (*_ready)(void);
+    std::atomic<bool> _preStarted;
+    std::atomic<uint32_t> _cancelled;
+};
+
+/*
+ * 一定時間LEDを光らせるリアクション
+ * LEDの更新はloop()側で行い，このリアクションは光らせる期限を決めるだけです。
+ */
+class LedReaction : public Reaction {
+public:
+    /*
+     * コンストラクタ
+     *
+     * @param color 光らせる色
+     * @param duration 光らせる時間（ミリ秒）
+     */
+    LedReaction(const AtomEcho::led_color_t& color, uint32_t duration)
+        : Reaction(REACTION_PRIORITY_HIGH, 1, REACTION_IGNORE),
+          _color(color),
+          _duration(duration),
+          _until(0) {
+    }
+
+    /*
+     * デストラクタ
+     */
+    virtual ~LedReaction(void) {
+    }
+
+    /*
+     * リアクションの名前を返します。
+     *
+     * @return リアクションの名前
+     */
+    virtual const char* getName(void) const {
+        return "LED";
+    }
+
+    /*
+     * LEDを光らせている最中かを返します。
+     *
+     * @param now 現在時刻（ミリ秒）
+     * @retval true 光らせている最中
+     * @retval false 光らせていない
+     */
+    bool isActive(uint32_t now) const {
+        return static_cast<int32_t>(this->_until - now) > 0;
+    }
+
+    /*
+     * 光らせる色を返します。
+     *
+     * @return 光らせる色
+     */
+    inline const AtomEcho::led_color_t& getColor(void) const {
+        return this->_color;
+    }
+
+protected:
+    virtual bool react(const trigger_event_t& event) {
+        this->_until = event.timestamp + this->_duration;
+        return true;
+    }
+
+private:
+    const AtomEcho::led_color_t _color;
+    const uint32_t _duration;
+    volatile uint32_t _until;
+};
+
+/*
+ * 発火した回数を数えるリアクション
+ */
+class CounterReaction : public Reaction {
+public:
+    /*
+     * コンストラクタ
+     *
+     * @param counter 回数を記録するカウンター
+     */
+    CounterReaction(OfferingCounter& counter)
+        : Reaction(REACTION_PRIORITY_HIGH, 1, REACTION_IGNORE),
+          _counter(counter) {
+    }
+
+    /*
+     * デストラクタ
+     */
+    virtual ~CounterReaction(void) {
+    }
+
+    /*
+     * リアクションの名前を返します。
+     *
+     * @return リアクションの名前
+     */
+    virtual const char* getName(void) const {
+        return "Counter";
+    }
+
+    /*
+     * 発火した回数を返します。
+     *
+     * @return 発火した回数
+     */
+    inline uint32_t getCount(void) {
+        return this->_counter.getTotal();
+    }
+
+protected:
+    virtual bool react(const trigger_event_t& event) {
+        this->_counter.increment();
+        return true;
+    }
+
+private:
+    OfferingCounter& _counter;
+};
+
+/*
+ * 発火をログに出力するリアクション
+ */
+class LogReaction : public Reaction {
+public:
+    /*
+     * コンストラクタ
+     */
+    LogReaction(void) : Reaction(REACTION_PRIORITY_LOW, 10, REACTION_IGNORE) {
+    }
+
+    /*
+     * デストラクタ
+     */
+    virtual ~LogReaction(void) {
+    }
+
+    /*
+     * リアクションの名前を返します。
+     *
+     * @return リアクションの名前
+     */
+    virtual const char* getName(void) const {
+        return "Log";
+    }
+
+protected:
+    virtual bool react(const trigger_event_t& event) {
+        ESP_LOGI("Event", "#%d %s at %dms (latency: %dms)", event.sequence,
+                 event.source, event.timestamp, millis() - event.timestamp);
+        return true;
+    }
+};
@@ -0,0 +1,206 @@
+#pragma once
+
+#include <esp_log.h>
+#include <stdint.h>
+
+/*
+ * センサーの状態
+ */
+enum sensor_health_t
+{
+    /* 正常に測定できている */
+    SENSOR_HEALTHY,
+    /* 測定に失敗しているが，まだ復旧処理はしていない */
+    SENSOR_DEGRADED,
+    /* 復旧処理中 */
+    SENSOR_RECOVERING,
+};
+
+/*
+ * センサーの復旧処理の段階。数字が大きいほど重い処理になる
+ */
+enum sensor_recovery_t
+{
+    /* 復旧処理なし */
+    RECOVERY_NONE = 0,
+    /* 連続測定を再開する */
+    RECOVERY_RESTART = 1,
+    /* バスをリセットしてから連続測定を再開する */
+    RECOVERY_BUS = 2,
+    /* バスをリセットしてからセンサーを初期化し直す */
+    RECOVERY_REINIT = 3,
+};
+
+/*
+ * センサーの測定の成否を監視し，必要な復旧処理の段階を決めるクラス
+ */
+class SensorHealthMonitor {
+public:
+    /* 復旧処理を始める連続失敗回数 */
+    static constexpr uint16_t DEFAULT_FAILURE_THRESHOLD = 3;
+    /* 復旧処理を始める最後の測定成功からの経過時間（ミリ秒） */
+    static constexpr uint32_t DEFAULT_STALL_TIMEOUT_MS = 2000;
+    /* 復旧処理の最短間隔（ミリ秒） */
+    static constexpr uint32_t DEFAULT_RETRY_INTERVAL_MS = 250;
+
+    /*
+     * コンストラクタ
+     *
+     * @param failureThreshold 復旧処理を始める連続失敗回数
+     * @param stallTimeout 復旧処理を始める最後の測定成功からの時間（ミリ秒）
+     * @param retryInterval 復旧処理の最短間隔（ミリ秒）
+     */
+    SensorHealthMonitor(uint16_t failureThreshold = DEFAULT_FAILURE_THRESHOLD,
+                        uint32_t stallTimeout = DEFAULT_STALL_TIMEOUT_MS,
+                        uint32_t retryInterval = DEFAULT_RETRY_INTERVAL_MS)
+        : _failureThreshold(failureThreshold),
+          _stallTimeout(stallTimeout),
+          _retryInterval(retryInterval),
+          _state(SENSOR_HEALTHY),
+          _level(RECOVERY_NONE),
+          _consecutiveFailures(0),
+          _lastSuccess(0),
+          _lastRecovery(0),
+          _failures(0),
+          _recoveries(0),
+          _recovered(0) {
+    }
+
+    /*
+     * デストラクタ
+     */
+    virtual ~SensorHealthMonitor(void) {
+    }
+
+    /*
+     * 監視を最初からやり直します。
+     *
+     * @param now 現在時刻（ミリ秒）
+     */
+    void reset(uint32_t now) {
+        this->_state = SENSOR_HEALTHY;
+        this->_level = RECOVERY_NONE;
+        this->_consecutiveFailures = 0;
+        this->_lastSuccess = now;
+    }
+
+    /*
+     * 測定に成功したことを記録します。
+     *
+     * @param now 現在時刻（ミリ秒）
+     */
+    void onSuccess(uint32_t now) {
+        if (this->_state == SENSOR_RECOVERING) {
+            ++(this->_recovered);
+            ESP_LOGI("Health",
+                     "Recovered at level %d after %dms (failures: %d, "
+                     "recoveries: %d/%d)",
+                     this->_level, now - this->_lastSuccess, this->_failures,
+                     this->_recovered, this->_recoveries);
+        }
+        this->_state = SENSOR_HEALTHY;
+        this->_level = RECOVERY_NONE;
+        this->_consecutiveFailures = 0;
+        this->_lastSuccess = now;
+    }
+
+    /*
+     * 測定に失敗したことを記録し，行うべき復旧処理の段階を返します。
+     * 復旧処理は失敗が続くごとに1段階ずつ重くなります。
+     *
+     * @param now 現在時刻（ミリ秒）
+     * @return 行うべき復旧処理の段階。何もしない場合はRECOVERY_NONE
+     */
+    sensor_recovery_t onFailure(uint32_t now) {
+        ++(this->_failures);
+        ++(this->_consecutiveFailures);
+        if (this->_state == SENSOR_HEALTHY) {
+            this->_state = SENSOR_DEGRADED;
+        }
+        const bool stalled = now - this->_lastSuccess >= this->_stallTimeout;
+        if (this->_consecutiveFailures < this->_failureThreshold && !stalled) {
+            return RECOVERY_NONE;
+        }
+        if (this->_state == SENSOR_RECOVERING &&
+            now - this->_lastRecovery < this->_retryInterval) {
+            return RECOVERY_NONE;
+        }
+        if (this->_level < RECOVERY_REINIT) {
+            this->_level = static_cast<sensor_recovery_t>(this->_level + 1);
+        }
+        this->_state = SENSOR_RECOVERING;
+        this->_lastRecovery = now;
+        ++(this->_recoveries);
+        ESP_LOGW("Health", "Recovery level %d (consecutive failures: %d)",
+                 this->_level, this->_consecutiveFailures);
+        return this->_level;
+    }
+
+    /*
+     * センサーの状態を返します。
+     *
+     * @return センサーの状態
+     */
+    inline sensor_health_t getState(void) const {
+        return this->_state;
+    }
+
+    /*
+     * 連続して失敗した回数を返します。
+     *
+     * @return 連続して失敗した回数
+     */
+    inline uint16_t getConsecutiveFailures(void) const {
+        return this->_consecutiveFailures;
+    }
+
+    /*
+     * 最後に測定に成功した時刻（ミリ秒）を返します。
+     *
+     * @return 最後に測定に成功した時刻（ミリ秒）
+     */
+    inline uint32_t getLastSuccess(void) const {
+        return this->_lastSuccess;
+    }
+
+    /*
+     * 測定に失敗した回数の合計を返します。
+     *
+     * @return 測定に失敗した回数
+     */
+    inline uint32_t getFailures(void) const {
+        return this->_failures;
+    }
+
+    /*
+     * 復旧処理をした回数の合計を返します。
+     *
+     * @return 復旧処理をした回数
+     */
+    inline uint32_t getRecoveries(void) const {
+        return this->_recoveries;
+    }
+
+    /*
+     * 復旧できた回数の合計を返します。
+     *
+     * @return 復旧できた回数
+     */
+    inline uint32_t getRecovered(void) const {
+        return this->_recovered;
+    }
+
+private:
+    const uint16_t _failureThreshold;
+    const uint32_t _stallTimeout;
+    const uint32_t _retryInterval;
+
+    sensor_health_t _state;
+    sensor_recovery_t _level;
+    uint16_t _consecutiveFailures;
+    uint32_t _lastSuccess;
+    uint32_t _lastRecovery;
+    uint32_t _failures;
+    uint32_t _recoveries;
+    uint32_t _recovered;
+};
@@ -1,7 +1,12 @@
 #include "ToFUnit.hpp"
 
 ToFUnit::ToFUnit(TwoWire& wire, uint8_t sda, uint8_t scl, uint16_t timeout)
-    : _sda(sda), _scl(scl), _timeout(timeout), _sensor(), _wire(wire) {
+    : _sda(sda),
+      _scl(scl),
+      _timeout(timeout),
+      _timingBudget(DEFAULT_TIMING_BUDGET_US),
+      _sensor(),
+      _wire(wire) {
 }
 
 ToFUnit::~ToFUnit(void) {
@@ -12,31 +17,60 @@ const char* ToFUnit::getName(void) const {
 }
 
 bool ToFUnit::begin(void) {
-    this->_wire.begin(this->_sda, this->_scl);
-    this->_sensor.setBus(&this->_wire);
-    this->_sensor.setAddress(I2C_ADDRESS);
-    this->_sensor.setTimeout(this->_timeout);
-    if (this->_sensor.init() == false) {
-        ESP_LOGE(getName(), "Failed to detect and initialize ToF Unit");
+    beginBus();
+    return beginSensor();
+}
+
+bool ToFUnit::getDistance(distance_unit_t& distance) {
+    distance_sample_t<distance_unit_t> sample;
+    if (getSample(sample) == false || sample.confidence == 0) {
         return false;
     }
-    this->_sensor.setMeasurementTimingBudget(200000);  // 高精度
-    this->_sensor.startContinuous();
+    distance = sample.distance;
     return true;
 }
 
-bool ToFUnit::getDistance(distance_unit_t& distance) {
-    distance_unit_t d = this->_sensor.readRangeContinuousMillimeters();
-    ESP_LOGD("ToFUnit", "Raw Distance: %dmm", d);
-    if (this->_sensor.timeoutOccurred()) {
-        ESP_LOGW(getName(), "Timeout");
-        return false;
+bool ToFUnit::getSample(distance_sample_t<distance_unit_t>& sample) {
+    // readRangeContinuousMillimeters()と同じ手順で，距離だけでなく
+    // 測定結果のレジスタをまとめて読む
+    const uint16_t timeout = this->_sensor.getTimeout();
+    const uint32_t start = millis();
+    while ((this->_sensor.readReg(VL53L0X::RESULT_INTERRUPT_STATUS) & 0x07) ==
+           0) {
+        if (timeout > 0 && millis() - start > timeout) {
+            ESP_LOGW(getName(), "Timeout");
+            return false;
+        }
     }
-    if (OUT_OF_RANGE_MIN <= d && d <= OUT_OF_RANGE_MAX) {
-        ESP_LOGW(getName(), "Out of Range");
+    uint8_t result[RESULT_SIZE];
+    this->_sensor.readMulti(VL53L0X::RESULT_RANGE_STATUS, result, RESULT_SIZE);
+    this->_sensor.writeReg(VL53L0X::SYSTEM_INTERRUPT_CLEAR, 0x01);
+    if (this->_sensor.last_status != 0) {
+        ESP_LOGW(getName(), "I2C error: %d", this->_sensor.last_status);
         return false;
     }
-    distance = d;
+
+    sample.status = toRangeStatus((result[0] & 0x78) >> 3);
+    sample.signalRate = (static_cast<uint16_t>(result[6]) << 8) | result[7];
+    sample.ambientRate = (static_cast<uint16_t>(result[8]) << 8) | result[9];
+    sample.distance = (static_cast<uint16_t>(result[10]) << 8) | result[11];
+    if (OUT_OF_RANGE_MIN <= sample.distance &&
+        sample.distance <= OUT_OF_RANGE_MAX) {
+        // センサーは正常に応答している。何もない，もしくは反射が弱いだけ
+        // なので，測定の失敗（復旧処理の対象）とはせずに使えない測定とする
+        ESP_LOGD(getName(), "Out of Range");
+        if (sample.status == RANGE_VALID) {
+            sample.status = RANGE_SIGNAL_FAIL;
+        }
+        sample.confidence = 0;
+        return true;
+    }
+    sample.confidence = estimateConfidence(sample);
+    ESP_LOGD("ToFUnit",
+             "Raw Distance: %dmm, Status: %d, Signal: %d, Ambient: %d, "
+             "Confidence: %d",
+             sample.distance, sample.status, sample.signalRate,
+             sample.ambientRate, sample.confidence);
     return true;
 }
 
@@ -51,3 +85,125 @@ distance_unit_t ToFUnit::getMaxDistance(void) const {
 double ToFUnit::getAccuracy(void) const {
     return ACCURACY;
 }
+
+bool ToFUnit::setTimingBudget(uint32_t us) {
+    if (us == 0) {
+        return false;
+    }
+    this->_timingBudget = us;
+    return true;
+}
+
+uint32_t ToFUnit::getTimingBudget(void) const {
+    return this->_timingBudget;
+}
+
+bool ToFUnit::recover(sensor_recovery_t level) {
+    switch (level) {
+        case RECOVERY_RESTART:
+            this->_sensor.stopContinuous();
+            this->_sensor.startContinuous();
+            return true;
+        case RECOVERY_BUS:
+            clearBus();
+            beginBus();
+            this->_sensor.stopContinuous();
+            this->_sensor.startContinuous();
+            return true;
+        case RECOVERY_REINIT:
+            clearBus();
+            beginBus();
+            return beginSensor();
+        default:
+            return false;
+    }
+}
+
+void ToFUnit::beginBus(void) {
+    this->_wire.begin(this->_sda, this->_scl);
+    this->_wire.setTimeOut(I2C_TIMEOUT_MS);
+}
+
+bool ToFUnit::beginSensor(void) {
+    this->_sensor.setBus(&this->_wire);
+    this->_sensor.setAddress(I2C_ADDRESS);
+    this->_sensor.setTimeout(this->_timeout);
+    if (this->_sensor.init() == false) {
+        ESP_LOGE(getName(), "Failed to detect and initialize ToF Unit");
+        return false;
+    }
+    if (this->_sensor.setMeasurementTimingBudget(this->_timingBudget) ==
+        false) {
+        ESP_LOGW(getName(), "Illegal timing budget: %dus", this->_timingBudget);
+        this->_timingBudget = DEFAULT_TIMING_BUDGET_US;
+        this->_sensor.setMeasurementTimingBudget(this->_timingBudget);
+    }
+    this->_sensor.startContinuous();
+    return true;
+}
+
+range_status_t ToFUnit::toRangeStatus(uint8_t deviceStatus) {
+    switch (deviceStatus) {
+        case 11:
+            return RANGE_VALID;
+        case 1:
+        case 2:
+        case 3:
+            return RANGE_HARDWARE_FAIL;
+        case 4:
+            return RANGE_SIGNAL_FAIL;
+        case 6:
+        case 9:
+            return RANGE_PHASE_FAIL;
+        case 8:
+        case 10:
+            return RANGE_MIN_RANGE_FAIL;
+        default:
+            return RANGE_NO_UPDATE;
+    }
+}
+
+uint8_t ToFUnit::estimateConfidence(
+    const distance_sample_t<distance_unit_t>& sample) {
+    if (sample.status != RANGE_VALID ||
+        sample.signalRate <= MIN_SIGNAL_RATE) {
+        return 0;
+    }
+    // 反射光の強さ：MIN_SIGNAL_RATEで0，FULL_SIGNAL_RATE以上で最大
+    const uint32_t strength =
+        sample.signalRate >= FULL_SIGNAL_RATE
+            ? MAX_CONFIDENCE
+            : MAX_CONFIDENCE * (sample.signalRate - MIN_SIGNAL_RATE) /
+                  (FULL_SIGNAL_RATE - MIN_SIGNAL_RATE);
+    // 環境光に対する反射光の割合
+    const uint32_t ratio =
+        MAX_CONFIDENCE * static_cast<uint32_t>(sample.signalRate) /
+        (static_cast<uint32_t>(sample.signalRate) + sample.ambientRate);
+    return static_cast<uint8_t>(strength * ratio / MAX_CONFIDENCE);
+}
+
+bool ToFUnit::clearBus(void) {
+    this->_wire.end();
+    pinMode(this->_sda, INPUT_PULLUP);
+    pinMode(this->_scl, OUTPUT_OPEN_DRAIN);
+    digitalWrite(this->_scl, HIGH);
+    for (uint8_t i = 0; i < BUS_CLEAR_PULSES && digitalRead(this->_sda) == LOW;
+         ++i) {
+        digitalWrite(this->_scl, LOW);
+        delayMicroseconds(BUS_CLEAR_HALF_PERIOD_US);
+        digitalWrite(this->_scl, HIGH);
+        delayMicroseconds(BUS_CLEAR_HALF_PERIOD_US);
+    }
+    // STOPコンディション（SCLがHighの間にSDAをLowからHighにする）
+    pinMode(this->_sda, OUTPUT_OPEN_DRAIN);
+    digitalWrite(this->_sda, LOW);
+    delayMicroseconds(BUS_CLEAR_HALF_PERIOD_US);
+    digitalWrite(this->_sda, HIGH);
+    delayMicroseconds(BUS_CLEAR_HALF_PERIOD_US);
+    pinMode(this->_sda, INPUT_PULLUP);
+    const bool released = digitalRead(this->_sda) == HIGH;
+    if (!released) {
+        ESP_LOGE(getName(), "SDA is stuck low");
+    }
+    return released;
+}
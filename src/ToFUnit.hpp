@@ -12,7 +12,7 @@ typedef uint16_t distance_unit_t;
  *
  * https://docs.m5stack.com/en/unit/tof
  */
-class ToFUnit : public DistanceMeasurable<distance_unit_t, 3> {
+class ToFUnit : public DistanceMeasurable<distance_unit_t> {
 public:
     /* 計測できる最小長（30mm） */
     static constexpr distance_unit_t MIN_DISTANCE_MM = 30;
@@ -22,11 +22,25 @@ public:
     static constexpr uint8_t I2C_ADDRESS = 0x29;
     /* 接続待ちのタイムアウト（500ミリ秒） */
     static constexpr uint16_t DEFAULT_CONNECTION_TIMEOUT = 500;
+    /* I2Cの応答待ちのタイムアウト（ミリ秒） */
+    static constexpr uint16_t I2C_TIMEOUT_MS = 50;
+    /* バスのリセット時にSCLに送るクロック数 */
+    static constexpr uint8_t BUS_CLEAR_PULSES = 9;
+    /* バスのリセット時のクロックの半周期（マイクロ秒，約100kHz） */
+    static constexpr uint32_t BUS_CLEAR_HALF_PERIOD_US = 5;
+    /* 1回の測定にかける時間（200ミリ秒：高精度） */
+    static constexpr uint32_t DEFAULT_TIMING_BUDGET_US = 200000;
     /* 測定精度（±3%）*/
     static constexpr double ACCURACY = 0.03;
     /* 測定不能だった場合の値。8190，8191が返る */
     static constexpr distance_unit_t OUT_OF_RANGE_MIN = 8190;
     static constexpr distance_unit_t OUT_OF_RANGE_MAX = 8191;
+    /* 測定結果のレジスタのバイト数（状態，反射光，環境光，距離） */
+    static constexpr uint8_t RESULT_SIZE = 12;
+    /* 使える測定とみなす最小の反射光の強さ（0.25MCPS，ライブラリの既定値） */
+    static constexpr uint16_t MIN_SIGNAL_RATE = 32;
+    /* 信頼度が最大になる反射光の強さ（1.0MCPS） */
+    static constexpr uint16_t FULL_SIGNAL_RATE = 128;
 
     /*
      * コンストラクタ
@@ -68,6 +82,22 @@ public:
      */
     virtual bool getDistance(distance_unit_t& distance);
 
+    /*
+     * 測定した距離を，測定の状態，反射光と環境光の強さ，信頼度と一緒に
+     * 返します。
+     * 距離と同じ1回のI2Cの読み出しで取るため，getDistance()と同じ時間で
+     * 測定できます。
+     *
+     * 測定不能（8190，8191）はセンサーが正常に応答した結果なので，
+     * 信頼度を0としてtrueを返します。falseを返すのはI2Cのエラーと
+     * タイムアウトだけです。
+     *
+     * @param sample 測定の結果
+     * @retval true 測定できた場合（信頼度が0のこともある）
+     * @retval false 測定できなかった場合（I2Cのエラー，タイムアウト）
+     */
+    virtual bool getSample(distance_sample_t<distance_unit_t>& sample);
+
     /*
      * 測定できる最小長（mm）を返します。
      *
@@ -89,10 +119,78 @@ public:
      */
     virtual double getAccuracy(void) const;
 
+    /*
+     * 測定できなくなったToF Unitを復旧させます。
+     *
+     * @param level 復旧処理の段階
+     * @retval true 復旧処理ができた
+     * @retval false 復旧処理ができなかった
+     */
+    virtual bool recover(sensor_recovery_t level);
+
+    /*
+     * 1回の測定にかける時間を設定します。
+     * begin()の前に呼ぶこと
+     *
+     * @param us 測定時間（マイクロ秒）
+     * @retval true 設定できた
+     * @retval false 設定できなかった
+     */
+    virtual bool setTimingBudget(uint32_t us);
+
+    /*
+     * 1回の測定にかける時間を返します。
+     *
+     * @return 測定時間（マイクロ秒）
+     */
+    virtual uint32_t getTimingBudget(void) const;
+
+protected:
+    /*
+     * I2Cバスを初期化します。
+     */
+    virtual void beginBus(void);
+
+    /*
+     * ToF Unitを初期化して連続測定を始めます。
+     *
+     * @retval true  初期化が成功した
+     * @retval false 初期化が失敗した
+     */
+    virtual bool beginSensor(void);
+
+    /*
+     * SDAをLowにしたままのデバイスを解放するため，SCLにクロックを送って
+     * STOPコンディションを出します。
+     *
+     * @retval true SDAが解放された
+     * @retval false SDAがLowのまま
+     */
+    virtual bool clearBus(void);
+
+    /*
+     * デバイスの測定の状態をVL53L0XのAPIのRangeStatusに変換します。
+     *
+     * @param deviceStatus RESULT_RANGE_STATUSのビット6-3
+     * @return 測定の状態
+     */
+    static range_status_t toRangeStatus(uint8_t deviceStatus);
+
+    /*
+     * 測定の状態，反射光と環境光の強さから信頼度を求めます。
+     * 反射光が弱いほど，環境光に対して反射光が弱いほど低くなります。
+     *
+     * @param sample 測定の結果
+     * @return 信頼度（0-255）
+     */
+    static uint8_t estimateConfidence(
+        const distance_sample_t<distance_unit_t>& sample);
+
 private:
     const uint8_t _sda;
     const uint8_t _scl;
     const uint16_t _timeout;
+    uint32_t _timingBudget;
 
     VL53L0X _sensor;
     TwoWire& _wire;
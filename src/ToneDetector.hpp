@@ -0,0 +1,167 @@
+#pragma once
+
+#include <math.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include <array>
+
+#include "HotPath.hpp"
+
+/*
+ * 指定した周波数帯の音の立ち上がりを検出するクラス
+ * フレームごとにGoertzelアルゴリズムで各周波数のパワーを求め，
+ * その合計が雑音レベルの一定倍を超えたときに検出します。
+ * 雑音レベルは検出していない間のパワーの指数移動平均で追従します。
+ * ESP32のFPUで速く計算できるよう，単精度浮動小数点数のみを使います。
+ *
+ * @param N_BINS 検出する周波数の数
+ */
+template <std::size_t N_BINS = 3>
+class ToneDetector {
+public:
+    /* 雑音レベルの一定倍（デフォルト：約12dB） */
+    static constexpr float DEFAULT_RATIO = 16.0f;
+    /* 雑音レベルの追従の速さ（指数移動平均の係数） */
+    static constexpr float DEFAULT_ADAPTATION = 0.05f;
+    /* 検出に必要な最小のパワー（フルスケールとの比） */
+    static constexpr float DEFAULT_MIN_POWER = 1e-6f;
+    /* 雑音レベルを学習するまで検出しないフレーム数 */
+    static constexpr uint32_t WARMUP_FRAMES = 16;
+
+    /*
+     * コンストラクタ
+     *
+     * @param sampleRate サンプリング周波数（Hz）
+     * @param frequencies 検出する周波数（Hz）
+     * @param ratio 検出する雑音レベルに対するパワーの比
+     * @param adaptation 雑音レベルの追従の速さ（0.0-1.0）
+     * @param minPower 検出に必要な最小のパワー（フルスケールとの比）
+     */
+    ToneDetector(uint32_t sampleRate,
+                 const std::array<float, N_BINS>& frequencies,
+                 float ratio = DEFAULT_RATIO,
+                 float adaptation = DEFAULT_ADAPTATION,
+                 float minPower = DEFAULT_MIN_POWER)
+        : _ratio(ratio),
+          _adaptation(adaptation),
+          _minPower(minPower),
+          _coeffs{},
+          _noiseFloor(0.0f),
+          _power(0.0f),
+          _energy(0.0f),
+          _frames(0),
+          _active(false) {
+        for (std::size_t i = 0; i < N_BINS; ++i) {
+            this->_coeffs[i] = 2.0f * cosf(2.0f * static_cast<float>(M_PI) *
+                                           frequencies[i] / sampleRate);
+        }
+    }
+
+    /*
+     * デストラクタ
+     */
+    ~ToneDetector(void) {
+    }
+
+    /*
+     * 1フレーム分のサンプルを処理します。
+     * 音の立ち上がり（検出していない状態から検出した状態への変化）でのみ
+     * trueを返します。
+     *
+     * @param samples サンプル（16bit，モノラル）
+     * @param len サンプル数
+     * @retval true 音の立ち上がりを検出した
+     * @retval false 検出しなかった
+     */
+    bool HOT_PATH process(const int16_t* samples, std::size_t len) {
+        if (samples == nullptr || len == 0) {
+            return false;
+        }
+        std::array<float, N_BINS> s1{};
+        std::array<float, N_BINS> s2{};
+        float energy = 0.0f;
+        for (std::size_t n = 0; n < len; ++n) {
+            const float x = samples[n] * (1.0f / 32768.0f);
+            energy += x * x;
+            for (std::size_t i = 0; i < N_BINS; ++i) {
+                const float s0 = x + this->_coeffs[i] * s1[i] - s2[i];
+                s2[i] = s1[i];
+                s1[i] = s0;
+            }
+        }
+        float power = 0.0f;
+        for (std::size_t i = 0; i < N_BINS; ++i) {
+            power += s1[i] * s1[i] + s2[i] * s2[i] -
+                     this->_coeffs[i] * s1[i] * s2[i];
+        }
+        const float n2 = static_cast<float>(len) * len;
+        this->_power = power / n2;
+        this->_energy = energy / len;
+
+        if (this->_frames < WARMUP_FRAMES) {
+            ++(this->_frames);
+            this->_noiseFloor =
+                this->_frames == 1
+                    ? this->_power
+                    : this->_noiseFloor +
+                          (this->_power - this->_noiseFloor) / this->_frames;
+            return false;
+        }
+        const bool loud = this->_power > this->_minPower &&
+                          this->_power > this->_noiseFloor * this->_ratio;
+        const bool onset = loud && !this->_active;
+        this->_active = loud;
+        if (!loud) {
+            this->_noiseFloor +=
+                (this->_power - this->_noiseFloor) * this->_adaptation;
+        }
+        return onset;
+    }
+
+    /*
+     * 雑音レベルの学習をやり直します。
+     */
+    void reset(void) {
+        this->_frames = 0;
+        this->_active = false;
+    }
+
+    /*
+     * 最後に処理したフレームの周波数帯のパワーを返します。
+     *
+     * @return パワー（フルスケールとの比）
+     */
+    inline float getPower(void) const {
+        return this->_power;
+    }
+
+    /*
+     * 最後に処理したフレームの全体のパワー（二乗平均）を返します。
+     *
+     * @return パワー（フルスケールとの比）
+     */
+    inline float getEnergy(void) const {
+        return this->_energy;
+    }
+
+    /*
+     * 雑音レベルを返します。
+     *
+     * @return 雑音レベル（フルスケールとの比）
+     */
+    inline float getNoiseFloor(void) const {
+        return this->_noiseFloor;
+    }
+
+private:
+    const float _ratio;
+    const float _adaptation;
+    const float _minPower;
+    std::array<float, N_BINS> _coeffs;
+    float _noiseFloor;
+    float _power;
+    float _energy;
+    uint32_t _frames;
+    bool _active;
+};
@@ -0,0 +1,358 @@
+#pragma once
+
+#include <Arduino.h>
+#include <esp_log.h>
+
+#include <array>
+
+#include "Triggerable.hpp"
+
+/*
+ * 複数のトリガーの組み合わせ方
+ */
+enum trigger_mode_t
+{
+    /*
+     * どれかが発火したら発火する（OR）
+     * 発火してから時間窓が過ぎるまでは，どのトリガーが発火しても発火しない
+     */
+    TRIGGER_ANY,
+    /* 時間窓内にすべてが発火したら発火する（AND） */
+    TRIGGER_ALL,
+    /* 時間窓内にk個以上が発火したら発火する（k-of-n） */
+    TRIGGER_K_OF_N,
+    /*
+     * 時間窓内に追加した順番で発火したら発火する（A→B）
+     * 同じ時刻（ミリ秒）に発火したトリガーは追加した順番に発火したと
+     * みなす
+     */
+    TRIGGER_SEQUENCE,
+};
+
+/*
+ * 複数のトリガーを組み合わせて1つのトリガーとして扱うクラス
+ * 各トリガーはFreeRTOSの1ティックに1回だけ評価し，同じティックに
+ * isTriggered()を何度呼んでも同じ結果を返します。loop()はdelay(1)で
+ * 1ティック以上待つため，1回の発火を2回のloop()で返すことはありません。
+ * トリガーのisTriggered()は状態を進めるため，1つのトリガーを複数の
+ * グループに追加しないこと（同じティックに2回評価されます）。
+ *
+ * @param MAX_MEMBERS 組み合わせるトリガーの最大数
+ */
+template <std::size_t MAX_MEMBERS = 4>
+class TriggerGroup : public Triggerable {
+public:
+    /*
+     * コンストラクタ
+     *
+     * @param mode 組み合わせ方
+     * @param window 時間窓（ミリ秒）。TRIGGER_ANYでは，1つのお賽銭を
+     *               複数のトリガーが検出しても1回だけ発火するよう，発火して
+     *               から次に発火できるまでの時間として使用する
+     * @param k 発火に必要なトリガーの数。TRIGGER_K_OF_Nで使用する
+     */
+    TriggerGroup(trigger_mode_t mode, uint32_t window = 0, uint8_t k = 1)
+        : _mode(mode),
+          _window(window),
+          _k(k),
+          _enabled(false),
+          _size(0),
+          _members{},
+          _firedAt{},
+          _hasFired{},
+          _tick(0),
+          _evaluated(false),
+          _result(false),
+          _lastTriggered(0),
+          _hasTriggered(false),
+          _sequenceInterval(0),
+          _direction(0),
+          _source(nullptr) {
+    }
+
+    /*
+     * デストラクタ
+     * 追加したトリガーは削除しません。
+     */
+    virtual ~TriggerGroup(void) {
+    }
+
+    /*
+     * トリガーの名前を返します。
+     *
+     * @return トリガーの名前
+     */
+    virtual const char* getName(void) const {
+        return "TriggerGroup";
+    }
+
+    /*
+     * トリガーを追加します。
+     * TRIGGER_SEQUENCEの場合は追加した順番が発火の順番になります。
+     * ほかのグループに追加したトリガーは追加しないこと
+     *
+     * @param member 追加するトリガー
+     * @retval true 追加できた
+     * @retval false 追加できなかった
+     */
+    virtual bool add(Triggerable* member) {
+        if (member == nullptr || this->_size >= MAX_MEMBERS) {
+            ESP_LOGE("TriggerGroup", "Failed to add member");
+            return false;
+        }
+        this->_members[this->_size] = member;
+        this->_hasFired[this->_size] = false;
+        ++(this->_size);
+        return true;
+    }
+
+    /*
+     * 組み合わせたトリガーが発火しているかを返します。
+     * 同じティックに既に評価していれば，トリガーを評価せずにそのときの
+     * 結果を返します。
+     *
+     * @retval true 組み合わせの条件を満たした
+     * @retval false 組み合わせの条件を満たしていない
+     */
+    virtual bool isTriggered(void) {
+        if (!this->_enabled || this->_size == 0) {
+            return false;
+        }
+        const TickType_t tick = xTaskGetTickCount();
+        if (this->_evaluated && this->_tick == tick) {
+            return this->_result;
+        }
+        this->_tick = tick;
+        this->_evaluated = true;
+        this->_result = evaluate(millis());
+        return this->_result;
+    }
+
+    /*
+     * 組み合わせたトリガーをすべて有効にします。
+     *
+     * @retval true トリガーを有効にできた
+     * @retval false トリガーを有効にできなかった
+     */
+    virtual bool enable(void) {
+        if (this->_enabled) {
+            ESP_LOGW("TriggerGroup", "Already enabled");
+            return false;
+        }
+        for (std::size_t i = 0; i < this->_size; ++i) {
+            if (!this->_members[i]->isEnabled()) {
+                this->_members[i]->enable();
+            }
+        }
+        clear();
+        this->_evaluated = false;
+        this->_enabled = true;
+        return true;
+    }
+
+    /*
+     * 組み合わせたトリガーをすべて無効にします。
+     *
+     * @retval true トリガーを無効にできた
+     * @retval false トリガーを無効にできなかった
+     */
+    virtual bool disable(void) {
+        if (!this->_enabled) {
+            ESP_LOGW("TriggerGroup", "Already disabled");
+            return false;
+        }
+        for (std::size_t i = 0; i < this->_size; ++i) {
+            if (this->_members[i]->isEnabled()) {
+                this->_members[i]->disable();
+            }
+        }
+        this->_enabled = false;
+        return true;
+    }
+
+    /*
+     * トリガーが有効かどうかを返します。
+     *
+     * @retval true トリガーが有効
+     * @retval false トリガーが無効
+     */
+    virtual bool isEnabled(void) {
+        return this->_enabled;
+    }
+
+    /*
+     * TRIGGER_ANYで，発火してから時間窓が過ぎていないかを返します。
+     * この間のメンバーの発火は同じお賽銭とみなしてまとめるため，発火の
+     * 予測もまとめること
+     *
+     * @param now 現在時刻（ミリ秒）
+     * @retval true 時間窓が過ぎていない
+     * @retval false 時間窓が過ぎた，もしくはTRIGGER_ANYではない
+     */
+    inline bool isDeduplicating(uint32_t now) const {
+        return this->_mode == TRIGGER_ANY && this->_hasTriggered &&
+               now - this->_lastTriggered <= this->_window;
+    }
+
+    /*
+     * 最後に順番通りに発火したときの最初から最後までの時間を返します。
+     * 通過速度の目安になります。
+     *
+     * @return 最初から最後のトリガーまでの時間（ミリ秒）
+     */
+    inline uint32_t getSequenceInterval(void) const {
+        return this->_sequenceInterval;
+    }
+
+    /*
+     * 最後に時間窓内ですべてのトリガーが発火したときの順番を返します。
+     *
+     * @retval 1 追加した順番通り（同じ時刻に発火したものを含む）
+     * @retval -1 追加した順番と逆
+     * @retval 0 順番が判定できなかった
+     */
+    inline int8_t getDirection(void) const {
+        return this->_direction;
+    }
+
+    /*
+     * 最後に発火したトリガーの名前を返します。
+     *
+     * @return 最後に発火したトリガーの名前。発火していなければグループの名前
+     */
+    inline const char* getSource(void) const {
+        return this->_source != nullptr ? this->_source : getName();
+    }
+
+protected:
+    /*
+     * 各トリガーを1回ずつ評価し，組み合わせの条件を判定します。
+     *
+     * @param now 現在時刻（ミリ秒）
+     * @retval true 組み合わせの条件を満たした
+     * @retval false 組み合わせの条件を満たしていない
+     */
+    virtual bool evaluate(uint32_t now) {
+        bool firedNow = false;
+        for (std::size_t i = 0; i < this->_size; ++i) {
+            if (this->_members[i]->isTriggered()) {
+                this->_firedAt[i] = now;
+                this->_hasFired[i] = true;
+                this->_source = this->_members[i]->getName();
+                firedNow = true;
+            } else if (this->_hasFired[i] &&
+                       now - this->_firedAt[i] > this->_window) {
+                this->_hasFired[i] = false;
+            }
+        }
+        if (!firedNow) {
+            return false;
+        }
+        bool triggered = false;
+        switch (this->_mode) {
+            case TRIGGER_ANY:
+                // 同じお賽銭をほかのトリガーでも検出したものとみなす
+                triggered = !this->_hasTriggered ||
+                            now - this->_lastTriggered > this->_window;
+                if (!triggered) {
+                    ESP_LOGD("TriggerGroup", "Deduplicated: %s",
+                             this->_source);
+                }
+                break;
+            case TRIGGER_ALL:
+                triggered = countFired() == this->_size;
+                break;
+            case TRIGGER_K_OF_N:
+                triggered = countFired() >= this->_k;
+                break;
+            case TRIGGER_SEQUENCE:
+                if (countFired() == this->_size) {
+                    triggered = updateSequence() && this->_direction > 0;
+                    if (!triggered) {
+                        clear();
+                    }
+                }
+                break;
+        }
+        if (triggered) {
+            this->_lastTriggered = now;
+            this->_hasTriggered = true;
+            ESP_LOGI("TriggerGroup", "Fired: mode %d (%d/%d)", this->_mode,
+                     countFired(), this->_size);
+            if (this->_mode != TRIGGER_ANY) {
+                clear();
+            }
+        }
+        return triggered;
+    }
+
+    /*
+     * 時間窓内に発火したトリガーの数を返します。
+     *
+     * @return 発火したトリガーの数
+     */
+    std::size_t countFired(void) const {
+        std::size_t n = 0;
+        for (std::size_t i = 0; i < this->_size; ++i) {
+            if (this->_hasFired[i]) {
+                ++n;
+            }
+        }
+        return n;
+    }
+
+    /*
+     * 発火した順番と時間を求めます。
+     * すべてのトリガーが時間窓内に発火していること
+     * 同じ時刻に発火したトリガーは追加した順番に発火したとみなすため，
+     * すべてが同じ時刻なら順番通り（間隔は0）になります。
+     *
+     * @retval true 順番が判定できた
+     * @retval false 順番が判定できなかった
+     */
+    bool updateSequence(void) {
+        bool forward = true;
+        bool backward = true;
+        for (std::size_t i = 1; i < this->_size; ++i) {
+            const int32_t d = static_cast<int32_t>(this->_firedAt[i] -
+                                                   this->_firedAt[i - 1]);
+            forward = forward && d >= 0;
+            backward = backward && d <= 0;
+        }
+        this->_direction = forward ? 1 : (backward ? -1 : 0);
+        if (this->_direction == 0) {
+            return false;
+        }
+        const uint32_t first = this->_firedAt[0];
+        const uint32_t last = this->_firedAt[this->_size - 1];
+        this->_sequenceInterval = forward ? last - first : first - last;
+        ESP_LOGD("TriggerGroup", "Sequence: direction %d, %dms",
+                 this->_direction, this->_sequenceInterval);
+        return true;
+    }
+
+    /*
+     * 発火の記録を消します。
+     */
+    void clear(void) {
+        this->_hasFired.fill(false);
+    }
+
+private:
+    const trigger_mode_t _mode;
+    const uint32_t _window;
+    const uint8_t _k;
+    bool _enabled;
+    std::size_t _size;
+    std::array<Triggerable*, MAX_MEMBERS> _members;
+    std::array<uint32_t, MAX_MEMBERS> _firedAt;
+    std::array<bool, MAX_MEMBERS> _hasFired;
+    TickType_t _tick;
+    bool _evaluated;
+    bool _result;
+    uint32_t _lastTriggered;
+    bool _hasTriggered;
+    uint32_t _sequenceInterval;
+    int8_t _direction;
+    const char* _source;
+};
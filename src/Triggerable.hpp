@@ -11,6 +11,13 @@ public:
     virtual ~Triggerable(void) {
     }
 
+    /*
+     * トリガーの名前を返します。
+     *
+     * @return トリガーの名前
+     */
+    virtual const char* getName(void) const = 0;
+
     /*
      * トリガーが発火したかどうか
      *
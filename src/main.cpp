@@ -1,16 +1,28 @@
 #include <Preferences.h>
 #include <SPIFFS.h>
 #include <esp_log.h>
+#include <freertos/event_groups.h>
+#include <sys/time.h>
 
 #include "AtomEcho.hpp"
+#include "BootTimeline.hpp"
+#include "CalibrationStore.hpp"
 #include "DistanceTrigger.hpp"
+#include "HeapGuard.hpp"
+#include "MicTrigger.hpp"
+#include "OfferingCounter.hpp"
+#include "ReactionDispatcher.hpp"
+#include "Reactions.hpp"
 #include "ToFUnit.hpp"
+#include "TriggerGroup.hpp"
 
 static constexpr bool FORMAT_SPIFFS_IF_FAILED = true;
 static constexpr const char* SOUND_EFFECT_WAV = "/sound-effect.wav";
 
 static const char* NVS_NAMESPACE = "deepest-box";    // Max 15 chars
 static const char* NVS_KEY_THRESHOLD = "threshold";  // Max 15 chars
+static const char* NVS_KEY_CALIBRATION = "calibration";  // Max 15 chars
+static const char* NVS_KEY_COUNTS = "counts";            // Max 15 chars
 
 static constexpr AtomEcho::led_color_t LED_COLOR_OK{0, 128, 0};
 static constexpr AtomEcho::led_color_t LED_COLOR_ERROR{128, 0, 0};
@@ -18,10 +30,43 @@ static constexpr AtomEcho::led_color_t LED_COLOR_CALIBRATION{0, 0, 128};
 static constexpr AtomEcho::led_color_t LED_COLOR_OFF{0, 0, 0};
 static constexpr AtomEcho::led_color_t LED_COLOR_ENABLED{0, 128, 0};
 static constexpr AtomEcho::led_color_t LED_COLOR_DISABLED{0, 0, 0};
+static constexpr AtomEcho::led_color_t LED_COLOR_RECOVERING{128, 64, 0};
+static constexpr AtomEcho::led_color_t LED_COLOR_FIRED{128, 128, 128};
 
 static constexpr uint8_t CALIBRATION_COUNT = 10;
-static constexpr uint8_t MM_WINDOW_SIZE = 10;
 static constexpr uint8_t VOLUME = 150;
+static constexpr uint32_t LED_FIRED_DURATION_MS = 200;
+/*
+ * 発火を予測して先に音を鳴らし始める時間（マイクロ秒）。0なら予測しない
+ * tools/prediction_eval.cppで遅れと誤発火を評価してから設定すること
+ */
+static constexpr uint32_t PREDICTION_LOOKAHEAD_US = 0;
+/*
+ * ToFセンサーとマイクの発火を1回のお賽銭とみなす時間（ミリ秒）
+ * お賽銭がセンサーの前を横切ってから箱の底に落ちるまでの時間より長くする
+ */
+static constexpr uint32_t TRIGGER_DEDUPE_MS = 500;
+/* シリアルで受け付けるコマンドの最大長 */
+static constexpr size_t SERIAL_COMMAND_SIZE = 32;
+
+/* 電源投入から測定開始までの目標時間（ミリ秒） */
+static constexpr uint32_t BOOT_TARGET_MS = 1000;
+/* 起動時に並行して初期化するタスクを動かすコア */
+static constexpr BaseType_t BOOT_TASK_CORE = 0;
+static constexpr uint32_t SENSOR_TASK_STACK_SIZE = 4096;
+static constexpr UBaseType_t SENSOR_TASK_PRIORITY = 2;
+static constexpr uint32_t STORAGE_TASK_STACK_SIZE = 4096;
+static constexpr UBaseType_t STORAGE_TASK_PRIORITY = 1;
+
+static constexpr EventBits_t BOOT_SENSOR_READY = BIT0;
+static constexpr EventBits_t BOOT_SENSOR_FAILED = BIT1;
+static constexpr EventBits_t BOOT_STORAGE_READY = BIT2;
+static constexpr EventBits_t BOOT_STORAGE_FAILED = BIT3;
+/*
+ * 再生の前にSPIFFSのマウントを待つ最大の時間（ミリ秒）
+ * これより遅れて鳴らしても意味がないため，間に合わなければ見送る
+ */
+static constexpr uint32_t STORAGE_WAIT_MS = 500;
 
 #if defined(DISTRIBUTION_FIRMWARE)
 extern const uint8_t SOUND_EFFECT_WAV_START[] asm(
@@ -63,10 +108,37 @@ bool restoreWav(FS& fs, const char* filename, const uint8_t* buf, size_t size) {
 }
 #endif
 
+#if defined(FLOAT_POLICY)
+// 比較用（firmware-perf-float）。発火する距離の範囲を浮動小数点数で求める
+typedef FloatPolicy TriggerPolicy;
+#else
+typedef FixedPointPolicy TriggerPolicy;
+#endif
+
 AtomEcho echo;
-DistanceTrigger<distance_unit_t, 3> trigger(new ToFUnit(Wire, AtomEcho::SDA_PIN,
-                                                        AtomEcho::SCL_PIN));
+DistanceTrigger<distance_unit_t, TriggerPolicy> trigger(
+    new ToFUnit(Wire, AtomEcho::SDA_PIN, AtomEcho::SCL_PIN));
+#if defined(ENABLE_MIC_TRIGGER)
+MicTrigger mic(echo);
+#endif
+TriggerGroup<2> triggers(TRIGGER_ANY, TRIGGER_DEDUPE_MS);
 Preferences prefs;
+BootTimeline<> timeline;
+EventGroupHandle_t bootEvents = nullptr;
+CalibrationStore calibrationStore(prefs, NVS_KEY_CALIBRATION,
+                                  NVS_KEY_THRESHOLD);
+calibration_model_t calibration{};
+/* 発火の予測のイベントを発行し，まだ結果が出ていないか */
+bool predicted = false;
+
+resource_state_t getStorageState(void);
+ReactionDispatcher<> dispatcher;
+SoundReaction sound(echo, SPIFFS, SOUND_EFFECT_WAV, getStorageState);
+LedReaction led(LED_COLOR_FIRED, LED_FIRED_DURATION_MS);
+OfferingCounter offerings(NVS_NAMESPACE, NVS_KEY_COUNTS);
+CounterReaction counter(offerings);
+LogReaction logger;
+HeapGuard heapGuard;
 
 inline void forever(void) {
     echo.showLED(LED_COLOR_ERROR);
@@ -82,25 +154,195 @@ void calibrationCallback(uint8_t count) {
     delay(500);
 }
 
-void setup(void) {
-    if (SPIFFS.begin(FORMAT_SPIFFS_IF_FAILED) == false) {
+/*
+ * センサーを初期化するタスク
+ * オーディオの初期化（M5.begin()）と並行して実行します。
+ * センサーはWire（I2C_NUM_0，Groveの26/32番ピン）を使い，M5.begin()は
+ * I2Cを使う機器（IMU，RTC）の検出をAtomEcho::begin()で止めているため，
+ * 同じバスやピンを同時に触ることはありません。
+ */
+void sensorTask(void* arg) {
+    const std::size_t phase = timeline.start("sensor");
+    const bool ok = trigger.begin(calibration.baseline);
+    timeline.finish(phase);
+    xEventGroupSetBits(bootEvents,
+                       ok ? BOOT_SENSOR_READY : BOOT_SENSOR_FAILED);
+    vTaskDelete(nullptr);
+}
+
+/*
+ * SPIFFSをマウントし，音源ファイルを準備するタスク
+ * 最初の再生までに終わっていればよいので，起動を待たせずに実行します。
+ */
+void storageTask(void* arg) {
+    const std::size_t phase = timeline.start("storage");
+    bool ok = SPIFFS.begin(FORMAT_SPIFFS_IF_FAILED);
+    if (ok) {
+#if defined(DISTRIBUTION_FIRMWARE)
+        restoreWav(SPIFFS, SOUND_EFFECT_WAV, SOUND_EFFECT_WAV_START,
+                   SOUND_EFFECT_WAV_SIZE);
+#endif
+        // 再生のたびにファイルを開かないよう，先に開いておく
+        if (!sound.prepare()) {
+            ESP_LOGE("SPIFFS", "Failed to open %s", SOUND_EFFECT_WAV);
+        }
+    } else {
         ESP_LOGE("SPIFFS", "Failed to mount SPIFFS");
+    }
+    timeline.finish(phase);
+    xEventGroupSetBits(bootEvents,
+                       ok ? BOOT_STORAGE_READY : BOOT_STORAGE_FAILED);
+    vTaskDelete(nullptr);
+}
+
+/*
+ * 指定したイベントのどちらかが起こるまで待ちます。
+ *
+ * @param ready 成功を表すビット
+ * @param failed 失敗を表すビット
+ * @param timeout 待つ最大の時間（ティック）
+ * @return 起こったイベントのビット。時間切れなら0
+ */
+EventBits_t waitBootEvent(EventBits_t ready, EventBits_t failed,
+                          TickType_t timeout = portMAX_DELAY) {
+    return xEventGroupWaitBits(bootEvents, ready | failed, pdFALSE, pdFALSE,
+                               timeout) &
+           (ready | failed);
+}
+
+/*
+ * ToFセンサーの状態と失敗・復旧の回数をJSONで出力します。
+ * 測定と同じloop()から呼ぶこと
+ *
+ * @param out 出力先
+ */
+void printHealth(Print& out) {
+    const SensorHealthMonitor& health = trigger.getHealth();
+    out.printf(
+        "{\"state\":%d,\"consecutiveFailures\":%u,\"lastSuccessMs\":%u,"
+        "\"failures\":%u,\"recoveries\":%u,\"recovered\":%u,"
+        "\"rejected\":%u}\n",
+        health.getState(), health.getConsecutiveFailures(),
+        health.getLastSuccess(), health.getFailures(), health.getRecoveries(),
+        health.getRecovered(), trigger.getRejectedCount());
+}
+
+/*
+ * シリアルで受け取ったコマンドを実行します。
+ * counts: お賽銭の回数をJSONで出力する
+ * health: ToFセンサーの状態と失敗・復旧の回数をJSONで出力する
+ * commit: お賽銭の回数をすぐにNVSへ書き込む
+ * time <UNIX時間>: 時刻を設定する（日ごと・1時間ごとの回数に使う）
+ */
+void handleSerial(void) {
+    static char command[SERIAL_COMMAND_SIZE];
+    static size_t length = 0;
+    while (Serial.available() > 0) {
+        const int c = Serial.read();
+        if (c != '\n' && c != '\r') {
+            if (length < SERIAL_COMMAND_SIZE - 1) {
+                command[length++] = c;
+            }
+            continue;
+        }
+        command[length] = '\0';
+        length = 0;
+        if (strcmp(command, "counts") == 0) {
+            offerings.printTo(Serial);
+        } else if (strcmp(command, "health") == 0) {
+            printHealth(Serial);
+        } else if (strcmp(command, "commit") == 0) {
+            Serial.println(offerings.commit() ? "ok" : "error");
+        } else if (strncmp(command, "time ", 5) == 0) {
+            const struct timeval tv = {
+                static_cast<time_t>(strtoul(command + 5, nullptr, 10)), 0};
+            Serial.println(settimeofday(&tv, nullptr) == 0 ? "ok" : "error");
+        } else if (command[0] != '\0') {
+            Serial.println("unknown command");
+        }
+    }
+}
+
+/*
+ * SPIFFSの状態を返します。
+ * マウント中ならSTORAGE_WAIT_MSまで待ち，それでも終わらなければ
+ * RESOURCE_PENDINGを返します（リアクションのワーカーを止め続けない）。
+ *
+ * @return SPIFFSの状態
+ */
+resource_state_t getStorageState(void) {
+    const EventBits_t bits =
+        waitBootEvent(BOOT_STORAGE_READY, BOOT_STORAGE_FAILED,
+                      pdMS_TO_TICKS(STORAGE_WAIT_MS));
+    if ((bits & BOOT_STORAGE_READY) != 0) {
+        return RESOURCE_READY;
+    }
+    return (bits & BOOT_STORAGE_FAILED) != 0 ? RESOURCE_FAILED
+                                             : RESOURCE_PENDING;
+}
+
+void setup(void) {
+    bootEvents = xEventGroupCreate();
+    if (bootEvents == nullptr) {
+        ESP_LOGE("Boot", "Failed to create event group");
         forever();
     }
-#if defined(DISTRIBUTION_FIRMWARE)
-    restoreWav(SPIFFS, SOUND_EFFECT_WAV, SOUND_EFFECT_WAV_START,
-               SOUND_EFFECT_WAV_SIZE);
-#endif
+    xTaskCreatePinnedToCore(storageTask, "storage", STORAGE_TASK_STACK_SIZE,
+                            nullptr, STORAGE_TASK_PRIORITY, nullptr,
+                            BOOT_TASK_CORE);
+
+    std::size_t phase = timeline.start("nvs");
     if (prefs.begin(NVS_NAMESPACE, false) == false) {
         ESP_LOGE("NVS", "Failed to initialize %s", NVS_NAMESPACE);
         forever();
     }
-    distance_unit_t threshold = prefs.getUShort(NVS_KEY_THRESHOLD, 0);
+    calibration.baseline = 0;
+    calibration.noiseVariance = 0;
+    calibration.timingBudget = ToFUnit::DEFAULT_TIMING_BUDGET_US;
+    const bool calibrated = calibrationStore.load(calibration);
+    trigger.setTimingBudget(calibration.timingBudget);
+    trigger.setLookahead(PREDICTION_LOOKAHEAD_US);
+    if (calibrated) {
+        // 閾値はセンサーの初期化（begin()）で渡す
+        trigger.setNoiseVariance(calibration.noiseVariance);
+    }
+    if (offerings.begin() == false) {
+        ESP_LOGE("Counter", "Failed to initialize");
+    }
+    timeline.finish(phase);
+
+    xTaskCreatePinnedToCore(sensorTask, "sensor", SENSOR_TASK_STACK_SIZE,
+                            nullptr, SENSOR_TASK_PRIORITY, nullptr,
+                            BOOT_TASK_CORE);
+
+    phase = timeline.start("audio");
     echo.begin();
     echo.setVolume(VOLUME);
     ESP_LOGI("Atom Echo", "Volume: %d", VOLUME);
     echo.update();
-    if (echo.isPressed() || threshold == 0) {
+#if defined(ENABLE_MIC_TRIGGER)
+    if (mic.begin() == false) {
+        ESP_LOGE("Trigger", "Failed to initialize %s", mic.getName());
+        forever();
+    }
+#else
+    // マイクを使わないため，再生のたびにI2Sを切り替えないようにする
+    if (echo.useSpeaker() == false) {
+        ESP_LOGE("Atom Echo", "Failed to initialize speaker");
+    }
+#endif
+    timeline.finish(phase);
+
+    if ((waitBootEvent(BOOT_SENSOR_READY, BOOT_SENSOR_FAILED) &
+         BOOT_SENSOR_READY) == 0) {
+        ESP_LOGE("Trigger", "Failed to initialize %s", trigger.getName());
+        prefs.end();
+        forever();
+    }
+
+    distance_unit_t threshold = calibration.baseline;
+    if (echo.isPressed() || !calibrated || threshold == 0) {
+        phase = timeline.start("calibration");
         ESP_LOGI("Trigger", "Calibration started");
         threshold = trigger.calibrate(CALIBRATION_COUNT, calibrationCallback);
         if (threshold == 0) {
@@ -108,36 +350,107 @@ void setup(void) {
             prefs.end();
             forever();
         } else {
-            prefs.putUShort(NVS_KEY_THRESHOLD, threshold);
+            calibration.baseline = threshold;
+            calibration.noiseVariance = trigger.getNoiseVariance();
+            calibration.timingBudget = trigger.getTimingBudget();
+            calibrationStore.save(calibration);
             ESP_LOGI("Trigger", "Calibration finished");
             echo.showLED(LED_COLOR_CALIBRATION);
         }
+        timeline.finish(phase);
+        if (trigger.begin(threshold) == false) {
+            ESP_LOGE("Trigger", "Failed to initialize %s", trigger.getName());
+            prefs.end();
+            forever();
+        }
     }
     prefs.end();
 
-    if (trigger.begin(threshold) == false) {
-        ESP_LOGE("Trigger", "Failed to initialize %s", trigger.getName());
+    dispatcher.add(&sound);
+    dispatcher.add(&led);
+    dispatcher.add(&counter);
+    dispatcher.add(&logger);
+    if (dispatcher.begin() == false) {
+        ESP_LOGE("Dispatcher", "Failed to initialize");
         forever();
     }
+
     ESP_LOGI("Trigger", "Distance Threshold: %dmm", threshold);
-    trigger.enable();
+    triggers.add(&trigger);
+#if defined(ENABLE_MIC_TRIGGER)
+    triggers.add(&mic);
+#endif
+    triggers.enable();
+    timeline.report(BOOT_TARGET_MS);
+
+    heapGuard.watch("loopTask");
+    heapGuard.watch("reaction-high");
+    heapGuard.watch("reaction");
+    heapGuard.watch("reaction-low");
+    heapGuard.watch("counter");
+#if defined(ENABLE_MIC_TRIGGER)
+    heapGuard.watch("mic");
+#endif
 }
 
 void loop(void) {
     echo.update();
-    echo.showLED(trigger.isEnabled() ? LED_COLOR_ENABLED : LED_COLOR_DISABLED);
+    if (!triggers.isEnabled()) {
+        echo.showLED(LED_COLOR_DISABLED);
+    } else if (!sound.isEnabled()) {
+        echo.showLED(LED_COLOR_ERROR);
+    } else if (trigger.getHealth().getState() == SENSOR_RECOVERING) {
+        echo.showLED(LED_COLOR_RECOVERING);
+    } else if (led.isActive(millis())) {
+        echo.showLED(led.getColor());
+    } else {
+        echo.showLED(LED_COLOR_ENABLED);
+    }
     if (echo.wasPressed()) {
-        if (trigger.isEnabled()) {
-            trigger.disable();
+        if (triggers.isEnabled()) {
+            triggers.disable();
         } else {
-            trigger.enable();
+            triggers.enable();
+            sound.enable();
         }
     }
-    if (trigger.isTriggered()) {
-        if (echo.playWav(SPIFFS, SOUND_EFFECT_WAV) == false) {
-            echo.showLED(LED_COLOR_ERROR);
-            forever();
-        }
+    const bool fired = triggers.isTriggered();
+    if (fired) {
+        dispatcher.publish(triggers.getSource());
+    }
+    switch (trigger.pollPrediction()) {
+        case PREDICTION_ARMED:
+            // ほかのトリガーで発火したばかりなら同じお賽銭とみなし，鳴らさない
+            if (!triggers.isDeduplicating(millis())) {
+                dispatcher.publish(trigger.getName(), TRIGGER_EVENT_PREDICTED);
+                predicted = true;
+            }
+            break;
+        case PREDICTION_CONFIRMED:
+            if (predicted && !fired) {
+                // ToFセンサーの発火はほかのトリガーの発火とまとめられ，
+                // 発火のイベントを発行していない。先に始めた再生は続ける
+                dispatcher.publish(trigger.getName(), TRIGGER_EVENT_CONFIRMED);
+            }
+            ESP_LOGD("Trigger", "Prediction confirmed");
+            predicted = false;
+            break;
+        case PREDICTION_CANCELLED:
+            if (predicted) {
+                dispatcher.cancel(trigger.getName());
+            }
+            predicted = false;
+            break;
+        case PREDICTION_NONE:
+            break;
+    }
+    handleSerial();
+    // SPIFFSのマウントと音源ファイルの準備が終わってから見張る
+    if (!heapGuard.isArmed() &&
+        (xEventGroupGetBits(bootEvents) &
+         (BOOT_STORAGE_READY | BOOT_STORAGE_FAILED)) != 0) {
+        heapGuard.arm();
     }
+    heapGuard.check();
     delay(1);
 }
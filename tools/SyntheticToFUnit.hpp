@@ -0,0 +1,244 @@
+#pragma once
+
+#include <Arduino.h>
+
+#include <cmath>
+#include <random>
+#include <vector>
+
+#include "ToFUnit.hpp"
+
+/*
+ * 合成データのパラメータ
+ */
+struct synthetic_profile_t
+{
+    /* 何もないときの距離（mm） */
+    double baseline;
+    /* 基準の測定時間でのノイズの標準偏差とToFUnit::ACCURACYの比 */
+    double noiseScale;
+    /* 測定不能（8190/8191）が返る確率 */
+    double outOfRangeRate;
+    /* タイムアウトする確率 */
+    double timeoutRate;
+    /* 1時間あたりの距離のドリフト（mm） */
+    double driftPerHour;
+    /* 1時間あたりのお賽銭の数 */
+    double coinsPerHour;
+    /* お賽銭がセンサーの前を横切る時間（ミリ秒）の範囲 */
+    double coinDurationMinMs;
+    double coinDurationMaxMs;
+    /* お賽銭が横切ったときの距離の変化（何もないときの距離との比）の範囲 */
+    double coinDepthMin;
+    double coinDepthMax;
+};
+
+/*
+ * お賽銭が横切ったイベント
+ */
+struct synthetic_coin_t
+{
+    /* 横切り始めた時刻（マイクロ秒） */
+    uint64_t start;
+    /* 横切っていた時間（マイクロ秒） */
+    uint64_t duration;
+    /* 距離の変化（何もないときの距離との比） */
+    double depth;
+};
+
+/*
+ * VL53L0Xの振る舞いを模擬するDistanceMeasurable
+ * 1回の測定ごとに測定時間だけシミュレーション時刻を進めます。
+ * 測定値は測定時間中にお賽銭が横切っていた時間の割合だけ短くなります。
+ */
+class SyntheticToFUnit : public DistanceMeasurable<distance_unit_t> {
+public:
+    /*
+     * コンストラクタ
+     *
+     * @param profile 合成データのパラメータ
+     * @param seed 乱数の種。お賽銭のイベントは測定値とは別の乱数で作るため，
+     *             同じ種なら測定の回数によらず同じイベント列になります
+     */
+    SyntheticToFUnit(const synthetic_profile_t& profile, uint32_t seed)
+        : _profile(profile),
+          _rng(seed),
+          _coinRng(seed ^ 0x5eedu),
+          _timingBudget(ToFUnit::DEFAULT_TIMING_BUDGET_US),
+          _coins(),
+          _next(0) {
+    }
+
+    /*
+     * デストラクタ
+     */
+    virtual ~SyntheticToFUnit(void) {
+    }
+
+    /*
+     * 指定した時間分のお賽銭のイベントを作ります。
+     *
+     * @param from 開始時刻（マイクロ秒）
+     * @param to 終了時刻（マイクロ秒）
+     */
+    void schedule(uint64_t from, uint64_t to) {
+        std::exponential_distribution<double> gap(
+            this->_profile.coinsPerHour / 3600e6);
+        std::uniform_real_distribution<double> duration(
+            this->_profile.coinDurationMinMs, this->_profile.coinDurationMaxMs);
+        std::uniform_real_distribution<double> depth(
+            this->_profile.coinDepthMin, this->_profile.coinDepthMax);
+        uint64_t t = from;
+        while (true) {
+            t += static_cast<uint64_t>(gap(this->_coinRng));
+            if (t >= to) {
+                break;
+            }
+            synthetic_coin_t coin;
+            coin.start = t;
+            coin.duration =
+                static_cast<uint64_t>(duration(this->_coinRng) * 1000);
+            coin.depth = depth(this->_coinRng);
+            this->_coins.push_back(coin);
+            t += coin.duration;
+        }
+    }
+
+    /*
+     * 作ったお賽銭のイベントを返します。
+     *
+     * @return お賽銭のイベント
+     */
+    const std::vector<synthetic_coin_t>& getCoins(void) const {
+        return this->_coins;
+    }
+
+    virtual bool begin(void) {
+        return true;
+    }
+
+    virtual const char* getName(void) const {
+        return "Synthetic ToF";
+    }
+
+    virtual bool getDistance(distance_unit_t& distance) {
+        distance_sample_t<distance_unit_t> sample;
+        if (getSample(sample) == false || sample.confidence == 0) {
+            return false;
+        }
+        distance = sample.distance;
+        return true;
+    }
+
+    /*
+     * ToFUnitと同じく，測定不能は信頼度0の測定として返し，falseを返すのは
+     * タイムアウトだけです。
+     */
+    virtual bool getSample(distance_sample_t<distance_unit_t>& sample) {
+        std::uniform_real_distribution<double> uniform(0.0, 1.0);
+        if (uniform(this->_rng) < this->_profile.timeoutRate) {
+            simAdvance(static_cast<uint64_t>(
+                           ToFUnit::DEFAULT_CONNECTION_TIMEOUT) *
+                       1000);
+            return false;
+        }
+        const uint64_t start = simClock();
+        simAdvance(this->_timingBudget);
+        sample.signalRate = 0;
+        sample.ambientRate = 0;
+        if (uniform(this->_rng) < this->_profile.outOfRangeRate) {
+            return outOfRange(sample);
+        }
+        const double hours = simClock() / 3600e6;
+        const double base =
+            this->_profile.baseline + this->_profile.driftPerHour * hours;
+        const double dip = coverage(start, simClock());
+        const double sigma =
+            base * ToFUnit::ACCURACY * this->_profile.noiseScale *
+            std::sqrt(static_cast<double>(ToFUnit::DEFAULT_TIMING_BUDGET_US) /
+                      this->_timingBudget);
+        std::normal_distribution<double> noise(0.0, sigma);
+        const double d = base * (1.0 - dip) + noise(this->_rng);
+        if (d < ToFUnit::MIN_DISTANCE_MM || d > ToFUnit::MAX_DISTANCE_MM) {
+            return outOfRange(sample);
+        }
+        sample.distance = static_cast<distance_unit_t>(d + 0.5);
+        sample.status = RANGE_VALID;
+        sample.confidence = MAX_CONFIDENCE;
+        return true;
+    }
+
+    virtual distance_unit_t getMinDistance(void) const {
+        return ToFUnit::MIN_DISTANCE_MM;
+    }
+
+    virtual distance_unit_t getMaxDistance(void) const {
+        return ToFUnit::MAX_DISTANCE_MM;
+    }
+
+    virtual double getAccuracy(void) const {
+        return ToFUnit::ACCURACY;
+    }
+
+    virtual bool setTimingBudget(uint32_t us) {
+        if (us == 0) {
+            return false;
+        }
+        this->_timingBudget = us;
+        return true;
+    }
+
+    virtual uint32_t getTimingBudget(void) const {
+        return this->_timingBudget;
+    }
+
+protected:
+    /*
+     * 測定時間中にお賽銭が横切っていた割合から，距離の変化を求めます。
+     *
+     * @param from 測定開始時刻（マイクロ秒）
+     * @param to 測定終了時刻（マイクロ秒）
+     * @return 距離の変化（何もないときの距離との比）
+     */
+    double coverage(uint64_t from, uint64_t to) {
+        while (this->_next < this->_coins.size() &&
+               this->_coins[this->_next].start +
+                       this->_coins[this->_next].duration <=
+                   from) {
+            ++(this->_next);
+        }
+        double dip = 0.0;
+        for (std::size_t i = this->_next;
+             i < this->_coins.size() && this->_coins[i].start < to; ++i) {
+            const synthetic_coin_t& c = this->_coins[i];
+            const uint64_t s = c.start > from ? c.start : from;
+            const uint64_t e =
+                c.start + c.duration < to ? c.start + c.duration : to;
+            if (e > s) {
+                dip += c.depth * (e - s) / static_cast<double>(to - from);
+            }
+        }
+        return dip;
+    }
+
+    /*
+     * 測定不能（8190）の測定を作ります。
+     *
+     * @param sample 測定の結果
+     * @retval true 常にtrue
+     */
+    bool outOfRange(distance_sample_t<distance_unit_t>& sample) {
+        sample.distance = ToFUnit::OUT_OF_RANGE_MIN;
+        sample.status = RANGE_SIGNAL_FAIL;
+        sample.confidence = 0;
+        return true;
+    }
+
+private:
+    const synthetic_profile_t _profile;
+    std::mt19937 _rng;
+    std::mt19937 _coinRng;
+    uint32_t _timingBudget;
+    std::vector<synthetic_coin_t> _coins;
+    std::size_t _next;
+};
@@ -0,0 +1,149 @@
+#pragma once
+
+#include <Arduino.h>
+#include <stdio.h>
+
+#include <algorithm>
+#include <vector>
+
+#include "ToFUnit.hpp"
+
+/*
+ * 記録した測定の1回分
+ */
+struct trace_sample_t
+{
+    /* 測定が終わった時刻（マイクロ秒） */
+    uint64_t time;
+    /* 測定した距離（mm） */
+    distance_unit_t distance;
+    /* 測定できたか */
+    bool valid;
+};
+
+/*
+ * 記録した測定を再生するDistanceMeasurable
+ * 測定ごとにシミュレーション時刻を記録した時刻まで進めます。
+ * 同じ記録を何度でも同じように再生できるため，パラメータの比較に使います。
+ */
+class TraceToFUnit : public DistanceMeasurable<distance_unit_t> {
+public:
+    /*
+     * コンストラクタ
+     *
+     * @param samples 記録した測定
+     * @param timingBudget 記録したときの測定時間（マイクロ秒）
+     */
+    TraceToFUnit(const std::vector<trace_sample_t>& samples,
+                 uint32_t timingBudget)
+        : _samples(samples), _timingBudget(timingBudget), _next(0) {
+    }
+
+    /*
+     * デストラクタ
+     */
+    virtual ~TraceToFUnit(void) {
+    }
+
+    /*
+     * "時刻（ミリ秒）,距離（mm）"の行からなるCSVを読み込みます。
+     * 距離が0の行は測定できなかったものとして扱います。
+     *
+     * @param filename ファイル名
+     * @param samples 読み込んだ測定
+     * @retval true 読み込めた
+     * @retval false 読み込めなかった
+     */
+    static bool load(const char* filename,
+                     std::vector<trace_sample_t>& samples) {
+        FILE* file = fopen(filename, "r");
+        if (file == nullptr) {
+            return false;
+        }
+        char line[64];
+        while (fgets(line, sizeof(line), file) != nullptr) {
+            double ms;
+            unsigned distance;
+            if (sscanf(line, "%lf,%u", &ms, &distance) != 2) {
+                continue;
+            }
+            trace_sample_t sample;
+            sample.time = static_cast<uint64_t>(ms * 1000);
+            sample.distance = static_cast<distance_unit_t>(distance);
+            sample.valid = distance != 0;
+            samples.push_back(sample);
+        }
+        fclose(file);
+        return !samples.empty();
+    }
+
+    /*
+     * 測定の間隔の中央値から測定時間を推定します。
+     *
+     * @param samples 記録した測定
+     * @return 測定時間（マイクロ秒）
+     */
+    static uint32_t estimateTimingBudget(
+        const std::vector<trace_sample_t>& samples) {
+        std::vector<uint64_t> intervals;
+        for (std::size_t i = 1; i < samples.size(); ++i) {
+            intervals.push_back(samples[i].time - samples[i - 1].time);
+        }
+        if (intervals.empty()) {
+            return ToFUnit::DEFAULT_TIMING_BUDGET_US;
+        }
+        std::nth_element(intervals.begin(),
+                         intervals.begin() + intervals.size() / 2,
+                         intervals.end());
+        return static_cast<uint32_t>(intervals[intervals.size() / 2]);
+    }
+
+    virtual bool begin(void) {
+        return true;
+    }
+
+    virtual const char* getName(void) const {
+        return "Trace ToF";
+    }
+
+    virtual bool getDistance(distance_unit_t& distance) {
+        if (this->_next >= this->_samples.size()) {
+            simAdvance(this->_timingBudget);
+            return false;
+        }
+        const trace_sample_t& sample = this->_samples[this->_next++];
+        if (sample.time > simClock()) {
+            simClock() = sample.time;
+        }
+        if (!sample.valid) {
+            return false;
+        }
+        distance = sample.distance;
+        return true;
+    }
+
+    virtual distance_unit_t getMinDistance(void) const {
+        return ToFUnit::MIN_DISTANCE_MM;
+    }
+
+    virtual distance_unit_t getMaxDistance(void) const {
+        return ToFUnit::MAX_DISTANCE_MM;
+    }
+
+    virtual double getAccuracy(void) const {
+        return ToFUnit::ACCURACY;
+    }
+
+    virtual bool setTimingBudget(uint32_t us) {
+        return us == this->_timingBudget;
+    }
+
+    virtual uint32_t getTimingBudget(void) const {
+        return this->_timingBudget;
+    }
+
+private:
+    const std::vector<trace_sample_t>& _samples;
+    const uint32_t _timingBudget;
+    std::size_t _next;
+};
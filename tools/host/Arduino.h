@@ -0,0 +1,65 @@
+#pragma once
+
+/*
+ * ホスト（PC）でファームウェアのヘッダーをコンパイルするための最小限の
+ * Arduino互換ヘッダー
+ * 時刻はスレッドごとのシミュレーション時刻で，simAdvance()で進めます。
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#define IRAM_ATTR
+
+typedef int portMUX_TYPE;
+#define portMUX_INITIALIZER_UNLOCKED 0
+#define portENTER_CRITICAL(mux)
+#define portEXIT_CRITICAL(mux)
+
+/*
+ * シミュレーション時刻（マイクロ秒）を返します。
+ *
+ * @return シミュレーション時刻への参照
+ */
+inline uint64_t& simClock(void) {
+    static thread_local uint64_t us = 0;
+    return us;
+}
+
+/*
+ * シミュレーション時刻を進めます。
+ *
+ * @param us 進める時間（マイクロ秒）
+ */
+inline void simAdvance(uint64_t us) {
+    simClock() += us;
+}
+
+inline uint32_t millis(void) {
+    return static_cast<uint32_t>(simClock() / 1000);
+}
+
+inline uint32_t micros(void) {
+    return static_cast<uint32_t>(simClock());
+}
+
+/*
+ * サイクル数の代わりにシミュレーション時刻（マイクロ秒）を返すESPクラス
+ */
+class EspClass {
+public:
+    uint32_t getCycleCount(void) {
+        return static_cast<uint32_t>(simClock());
+    }
+};
+
+static EspClass ESP;
+
+inline void delay(uint32_t ms) {
+    simAdvance(static_cast<uint64_t>(ms) * 1000);
+}
+
+inline void delayMicroseconds(uint32_t us) {
+    simAdvance(us);
+}
@@ -0,0 +1,6 @@
+#pragma once
+
+/*
+ * ホスト（PC）でToFUnit.hppを読み込むための空のVL53L0X
+ */
+class VL53L0X {};
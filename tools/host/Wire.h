@@ -0,0 +1,6 @@
+#pragma once
+
+/*
+ * ホスト（PC）でToFUnit.hppを読み込むための空のTwoWire
+ */
+class TwoWire {};
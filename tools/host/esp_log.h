@@ -0,0 +1,26 @@
+#pragma once
+
+/*
+ * ホスト（PC）用のログ出力
+ * HOST_LOG_LEVELでレベルを指定します（0:なし，1:E，2:W，3:I，4:D，5:V）。
+ */
+
+#include <stdio.h>
+
+#ifndef HOST_LOG_LEVEL
+#define HOST_LOG_LEVEL 1
+#endif
+
+#define HOST_LOG(level, letter, tag, format, ...)                           \
+    do {                                                                    \
+        if (HOST_LOG_LEVEL >= level) {                                      \
+            fprintf(stderr, letter " (%s) " format "\n", tag,              \
+                    ##__VA_ARGS__);                                         \
+        }                                                                   \
+    } while (0)
+
+#define ESP_LOGE(tag, format, ...) HOST_LOG(1, "E", tag, format, ##__VA_ARGS__)
+#define ESP_LOGW(tag, format, ...) HOST_LOG(2, "W", tag, format, ##__VA_ARGS__)
+#define ESP_LOGI(tag, format, ...) HOST_LOG(3, "I", tag, format, ##__VA_ARGS__)
+#define ESP_LOGD(tag, format, ...) HOST_LOG(4, "D", tag, format, ##__VA_ARGS__)
+#define ESP_LOGV(tag, format, ...) HOST_LOG(5, "V", tag, format, ##__VA_ARGS__)
@@ -0,0 +1,170 @@
+#!/usr/bin/env python3
+"""
+ビルドプロファイルごとのサイズと測定の遅れを比較するツール
+
+firmware-release，firmware-debug，firmware-perf，firmware-perf-float，
+firmware-micをビルドし，イメージサイズ，IRAM・DRAMの使用量，フラッシュに
+置かれたコードのサイズを表にします。
+シリアルのログを指定すると，DistanceTriggerが出力する判定のサイクル数と
+測定の間隔（最大値が測定時間より長ければ，その分だけ測定が止まっている），
+発火する距離の範囲を求めるのにかかったサイクル数，MicTriggerが出力する
+検出処理のCPU使用率と各コアの負荷（平均）も表に加えます。
+
+ログの取り方（リポジトリのルートで）:
+  pio run -e firmware-perf -t upload
+  pio device monitor -e firmware-perf | tee perf.log
+  （お賽銭を入れてからシリアルでcommitを送り，書き込み中の測定の間隔も記録する）
+
+firmware-releaseは判定のログを出さないため，ログを取るときだけ
+  PLATFORMIO_BUILD_FLAGS=-DTRIGGER_PROFILE pio run -e firmware-release -t upload
+でビルドしてください。
+
+使い方:
+  python3 tools/perf_report.py [--no-build] \\
+      [--log firmware-release=release.log] [--log firmware-perf=perf.log] \\
+      [--log firmware-mic=mic.log]
+"""
+import argparse
+import glob
+import os
+import re
+import shutil
+import subprocess
+import sys
+
+ENVS = ["firmware-release", "firmware-debug", "firmware-perf",
+        "firmware-perf-float", "firmware-mic"]
+
+DECISION_PATTERN = re.compile(
+    r"Decision: (\d+) cycles/sample \(max: (\d+)\), "
+    r"interval: (\d+)us \(max: (\d+)us\)"
+)
+BOUNDS_PATTERN = re.compile(r"Bounds: (\d+) cycles")
+MIC_CPU_PATTERN = re.compile(r"CPU usage: ([\d.]+)% of core (\d+)")
+CORE_LOAD_PATTERN = re.compile(r"Core (\d+) load: ([\d.]+)%")
+
+
+def find_size_tool():
+    """xtensa-esp32-elf-sizeのパスを返す"""
+    tool = shutil.which("xtensa-esp32-elf-size")
+    if tool is not None:
+        return tool
+    pattern = os.path.expanduser(
+        "~/.platformio/packages/toolchain-xtensa-esp32*/bin/xtensa-esp32-elf-size"
+    )
+    candidates = sorted(glob.glob(pattern))
+    return candidates[-1] if candidates else None
+
+
+def read_sections(size_tool, elf):
+    """ELFのセクションごとのサイズを返す"""
+    output = subprocess.run(
+        [size_tool, "-A", elf], check=True, capture_output=True, text=True
+    ).stdout
+    sections = {}
+    for line in output.splitlines():
+        fields = line.split()
+        if len(fields) >= 2 and fields[0].startswith(".") and fields[1].isdigit():
+            sections[fields[0]] = int(fields[1])
+    return sections
+
+
+def read_log(path):
+    """ログから判定のサイクル数と測定の間隔を集計する"""
+    cycles = []
+    max_cycles = 0
+    intervals = []
+    max_interval = 0
+    bounds = []
+    mic = []
+    loads = {}
+    with open(path, errors="replace") as f:
+        for line in f:
+            b = BOUNDS_PATTERN.search(line)
+            if b is not None:
+                bounds.append(int(b.group(1)))
+            c = MIC_CPU_PATTERN.search(line)
+            if c is not None:
+                mic.append(float(c.group(1)))
+            l = CORE_LOAD_PATTERN.search(line)
+            if l is not None:
+                loads.setdefault(int(l.group(1)), []).append(float(l.group(2)))
+            m = DECISION_PATTERN.search(line)
+            if m is None:
+                continue
+            cycles.append(int(m.group(1)))
+            max_cycles = max(max_cycles, int(m.group(2)))
+            intervals.append(int(m.group(3)))
+            max_interval = max(max_interval, int(m.group(4)))
+    if not cycles and not mic and not bounds:
+        return None
+    return {
+        "cycles": sum(cycles) / len(cycles) if cycles else None,
+        "max_cycles": max_cycles,
+        "interval": sum(intervals) / len(intervals) if intervals else None,
+        "max_interval": max_interval,
+        "bounds": max(bounds) if bounds else None,
+        "mic": sum(mic) / len(mic) if mic else None,
+        "loads": [sum(v) / len(v) for _, v in sorted(loads.items())],
+    }
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[1])
+    parser.add_argument("--no-build", action="store_true", help="ビルドしない")
+    parser.add_argument(
+        "--log", action="append", default=[], metavar="ENV=FILE",
+        help="プロファイルごとのシリアルのログ",
+    )
+    args = parser.parse_args()
+
+    logs = {}
+    for item in args.log:
+        env, _, path = item.partition("=")
+        if env not in ENVS or not path:
+            parser.error("Illegal log: %s" % item)
+        logs[env] = path
+
+    if not args.no_build:
+        for env in ENVS:
+            subprocess.run(["pio", "run", "-e", env], check=True)
+
+    size_tool = find_size_tool()
+    if size_tool is None:
+        sys.exit("xtensa-esp32-elf-size is not found")
+
+    print("| Profile | Image (bytes) | IRAM (bytes) | DRAM (bytes) "
+          "| Flash code (bytes) | Decision (cycles, avg/max) "
+          "| Interval (us, avg/max) | Bounds (cycles, max) "
+          "| Mic (CPU %, core loads %) |")
+    print("| --- | ---: | ---: | ---: | ---: | ---: | ---: | ---: | ---: |")
+    for env in ENVS:
+        build_dir = os.path.join(".pio", "build", env)
+        elf = os.path.join(build_dir, "firmware.elf")
+        image = os.path.join(build_dir, "firmware.bin")
+        if not os.path.exists(elf) or not os.path.exists(image):
+            print("| %s | (not built) | | | | | | | |" % env)
+            continue
+        sections = read_sections(size_tool, elf)
+        iram = sections.get(".iram0.vectors", 0) + sections.get(".iram0.text", 0)
+        dram = sections.get(".dram0.data", 0) + sections.get(".dram0.bss", 0)
+        flash = sections.get(".flash.text", 0)
+        stats = read_log(logs[env]) if env in logs else None
+        if stats is None:
+            decision = interval = bounds = mic = "-"
+        elif stats["cycles"] is None:
+            decision = interval = "-"
+        else:
+            decision = "%.0f / %d" % (stats["cycles"], stats["max_cycles"])
+            interval = "%.0f / %d" % (stats["interval"], stats["max_interval"])
+        if stats is not None:
+            bounds = "-" if stats["bounds"] is None else "%d" % stats["bounds"]
+            mic = "-" if stats["mic"] is None else "%.2f (%s)" % (
+                stats["mic"], " / ".join("%.1f" % l for l in stats["loads"]))
+        print("| %s | %d | %d | %d | %d | %s | %s | %s | %s |" % (
+            env, os.path.getsize(image), iram, dram, flash, decision, interval,
+            bounds, mic))
+
+
+if __name__ == "__main__":
+    main()
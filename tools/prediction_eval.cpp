@@ -0,0 +1,291 @@
+/*
+ * DistanceTriggerの発火の予測を記録した測定で評価するツール
+ *
+ * 同じ測定の記録を予測する時間ごとに再生し，音が鳴り始めるまでの遅れ
+ * （平均・99パーセンタイル），見逃し率，誤発火と予測が外れた回数，
+ * 予測が外れて音が鳴っていた時間をCSVで出力します。
+ * 記録を指定しない場合は，SyntheticToFUnitで合成した記録を使います。
+ * 記録を指定した場合は，予測しないときの発火をお賽銭が来た時刻とみなします。
+ *
+ * ビルド（リポジトリのルートで）:
+ *   g++ -std=gnu++11 -O2 -Itools/host -Isrc -Itools \
+ *       tools/prediction_eval.cpp -o prediction_eval
+ *
+ * 使い方:
+ *   ./prediction_eval [-f 記録.csv] [-b 測定時間] [-h 時間] [-s 乱数の種]
+ *                     [-n ノイズの大きさ] [-a 音が鳴り始めるまでの時間]
+ *                     [-k 近づいているとみなす変化（標準偏差の倍数）]
+ *                     > prediction.csv
+ */
+#include <Arduino.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <vector>
+
+#include "DistanceTrigger.hpp"
+#include "SyntheticToFUnit.hpp"
+#include "TraceToFUnit.hpp"
+
+/*
+ * お賽銭が来たイベント
+ */
+struct offering_event_t
+{
+    /* 来た時刻（マイクロ秒） */
+    uint64_t start;
+    /* センサーの前にいた時間（マイクロ秒） */
+    uint64_t duration;
+};
+
+/*
+ * 1回の再生の結果
+ */
+struct replay_result_t
+{
+    /* 音を鳴らし始めた時刻（マイクロ秒） */
+    std::vector<uint64_t> soundStarts;
+    /* 予測が外れて止めるまで音が鳴っていた時間（マイクロ秒） */
+    std::vector<uint64_t> falseStarts;
+    /* 発火した時刻（マイクロ秒） */
+    std::vector<uint64_t> fires;
+};
+
+/* 予測する時間（測定時間との比） */
+static const double LOOKAHEADS[] = {0.0, 0.5, 1.0, 1.5, 2.0, 3.0};
+
+static const uint8_t CALIBRATION_COUNT = 10;
+/* 測定の間隔（loop()のdelay(1)に相当，マイクロ秒） */
+static const uint64_t LOOP_INTERVAL_US = 1000;
+/* 近づいているとみなす距離の変化（ノイズの標準偏差の倍数） */
+static uint32_t sigmas =
+    DistanceTrigger<distance_unit_t>::DEFAULT_PREDICTION_SIGMAS;
+
+static synthetic_profile_t profile = {
+    150.0,  // baseline
+    0.15,   // noiseScale
+    0.001,  // outOfRangeRate
+    0.0005, // timeoutRate
+    2.0,    // driftPerHour
+    30.0,   // coinsPerHour
+    5.0,    // coinDurationMinMs
+    30.0,   // coinDurationMaxMs
+    0.3,    // coinDepthMin
+    0.8,    // coinDepthMax
+};
+
+/*
+ * SyntheticToFUnitで測定の記録を作ります。
+ *
+ * @param budget 測定時間（マイクロ秒）
+ * @param hours 記録する時間
+ * @param seed 乱数の種
+ * @param samples 作った記録
+ * @param events お賽銭が来たイベント
+ */
+static void synthesize(uint32_t budget, double hours, uint32_t seed,
+                       std::vector<trace_sample_t>& samples,
+                       std::vector<offering_event_t>& events) {
+    simClock() = 0;
+    SyntheticToFUnit unit(profile, seed);
+    unit.setTimingBudget(budget);
+    // 校正が終わるまではお賽銭を入れない
+    const uint64_t start =
+        static_cast<uint64_t>(CALIBRATION_COUNT) * budget + 1000000;
+    const uint64_t end = start + static_cast<uint64_t>(hours * 3600e6);
+    unit.schedule(start, end);
+    for (const synthetic_coin_t& c : unit.getCoins()) {
+        events.push_back({c.start, c.duration});
+    }
+    while (simClock() < end) {
+        trace_sample_t sample = {0, 0, false};
+        sample.valid = unit.getDistance(sample.distance);
+        sample.time = simClock();
+        samples.push_back(sample);
+        simAdvance(LOOP_INTERVAL_US);
+    }
+}
+
+/*
+ * 記録を再生し，音を鳴らし始めた時刻と予測が外れた回数を求めます。
+ *
+ * @param samples 記録した測定
+ * @param budget 測定時間（マイクロ秒）
+ * @param lookahead 予測する時間（マイクロ秒）
+ * @return 再生の結果
+ */
+static replay_result_t replay(const std::vector<trace_sample_t>& samples,
+                              uint32_t budget, uint32_t lookahead) {
+    simClock() = samples.empty() ? 0 : samples.front().time - budget;
+    DistanceTrigger<distance_unit_t> trigger(
+        new TraceToFUnit(samples, budget));
+    trigger.setLookahead(lookahead);
+    trigger.setPredictionSigmas(sigmas);
+    const distance_unit_t threshold = trigger.calibrate(CALIBRATION_COUNT);
+    trigger.begin(threshold);
+    trigger.enable();
+
+    replay_result_t result;
+    const uint64_t end = samples.empty() ? 0 : samples.back().time;
+    uint64_t armedAt = 0;
+    bool armed = false;
+    while (simClock() < end) {
+        const bool fired = trigger.isTriggered();
+        const uint64_t now = simClock();
+        switch (trigger.pollPrediction()) {
+            case PREDICTION_ARMED:
+                armed = true;
+                armedAt = now;
+                result.soundStarts.push_back(now);
+                break;
+            case PREDICTION_CANCELLED:
+                armed = false;
+                result.soundStarts.pop_back();
+                result.falseStarts.push_back(now - armedAt);
+                break;
+            case PREDICTION_CONFIRMED:
+                armed = false;
+                break;
+            default:
+                if (fired) {
+                    result.soundStarts.push_back(now);
+                }
+                break;
+        }
+        if (fired) {
+            result.fires.push_back(now);
+        }
+        simAdvance(LOOP_INTERVAL_US);
+    }
+    if (armed) {
+        result.soundStarts.pop_back();
+    }
+    return result;
+}
+
+int main(int argc, char* argv[]) {
+    const char* filename = nullptr;
+    uint32_t budget = 33000;
+    double hours = 4.0;
+    uint32_t seed = 1;
+    double audioStartMs = 30.0;
+    int opt;
+    while ((opt = getopt(argc, argv, "f:b:h:s:n:a:k:")) != -1) {
+        switch (opt) {
+            case 'f':
+                filename = optarg;
+                break;
+            case 'b':
+                budget = strtoul(optarg, nullptr, 10);
+                break;
+            case 'h':
+                hours = atof(optarg);
+                break;
+            case 's':
+                seed = strtoul(optarg, nullptr, 10);
+                break;
+            case 'n':
+                profile.noiseScale = atof(optarg);
+                break;
+            case 'a':
+                audioStartMs = atof(optarg);
+                break;
+            case 'k':
+                sigmas = strtoul(optarg, nullptr, 10);
+                break;
+            default:
+                fprintf(stderr,
+                        "Usage: %s [-f trace.csv] [-b timing_budget_us] "
+                        "[-h hours] [-s seed] [-n noise] [-a audio_start_ms] "
+                        "[-k sigmas]\n",
+                        argv[0]);
+                return 1;
+        }
+    }
+
+    std::vector<trace_sample_t> samples;
+    std::vector<offering_event_t> events;
+    if (filename != nullptr) {
+        if (!TraceToFUnit::load(filename, samples)) {
+            fprintf(stderr, "Failed to load %s\n", filename);
+            return 1;
+        }
+        budget = TraceToFUnit::estimateTimingBudget(samples);
+        // 予測しないときの発火をお賽銭が来た時刻とみなす
+        for (uint64_t t : replay(samples, budget, 0).fires) {
+            events.push_back({t, 0});
+        }
+    } else {
+        synthesize(budget, hours, seed, samples, events);
+    }
+    hours = samples.empty()
+                ? 0.0
+                : (samples.back().time - samples.front().time) / 3600e6;
+    if (hours <= 0.0) {
+        fprintf(stderr, "Trace is too short\n");
+        return 1;
+    }
+    fprintf(stderr, "Timing budget: %uus, %.2f hours, %zu events\n", budget,
+            hours, events.size());
+
+    printf(
+        "lookahead_us,events,miss_rate,mean_latency_ms,p99_latency_ms,"
+        "false_fires_per_hour,false_starts_per_hour,mean_false_start_ms\n");
+    for (double ratio : LOOKAHEADS) {
+        const uint32_t lookahead = static_cast<uint32_t>(ratio * budget);
+        const replay_result_t r = replay(samples, budget, lookahead);
+
+        // 予測で早く鳴らした分もそのお賽銭に対する音とみなす
+        const uint64_t lead = lookahead + budget;
+        std::vector<bool> detected(events.size(), false);
+        std::vector<double> latencies;
+        std::size_t falseFires = 0;
+        std::size_t next = 0;
+        for (uint64_t s : r.soundStarts) {
+            while (next < events.size() &&
+                   events[next].start + events[next].duration + budget < s) {
+                ++next;
+            }
+            if (next < events.size() && events[next].start <= s + lead &&
+                !detected[next]) {
+                detected[next] = true;
+                latencies.push_back(
+                    (static_cast<double>(s) - events[next].start) / 1000.0 +
+                    audioStartMs);
+            } else {
+                ++falseFires;
+            }
+        }
+
+        double meanLatency = 0.0;
+        double p99Latency = 0.0;
+        if (!latencies.empty()) {
+            double sum = 0.0;
+            for (double l : latencies) {
+                sum += l;
+            }
+            meanLatency = sum / latencies.size();
+            std::sort(latencies.begin(), latencies.end());
+            p99Latency = latencies[(latencies.size() - 1) * 99 / 100];
+        }
+        double meanFalseStart = 0.0;
+        if (!r.falseStarts.empty()) {
+            double sum = 0.0;
+            for (uint64_t f : r.falseStarts) {
+                sum += f / 1000.0;
+            }
+            meanFalseStart = sum / r.falseStarts.size();
+        }
+        const std::size_t missed =
+            std::count(detected.begin(), detected.end(), false);
+        printf("%u,%zu,%.4f,%.1f,%.1f,%.2f,%.2f,%.1f\n", lookahead,
+               events.size(),
+               events.empty() ? 0.0
+                              : static_cast<double>(missed) / events.size(),
+               meanLatency, p99Latency, falseFires / hours,
+               r.falseStarts.size() / hours, meanFalseStart);
+    }
+    return 0;
+}
@@ -0,0 +1,171 @@
+/*
+ * 録音したWAVファイルをToneDetectorに通して検出結果を確認するツール
+ *
+ * MicTriggerと同じフレームサイズと周波数でWAVファイルを処理し，
+ * 音を検出した時刻と処理速度を出力します。
+ * 16bit PCMのWAVファイルに対応しています。ステレオの場合はモノラルにします。
+ *
+ * ビルド（リポジトリのルートで）:
+ *   g++ -std=gnu++11 -O2 -Isrc tools/tone_detect.cpp -o tone_detect
+ *
+ * 使い方:
+ *   ./tone_detect [-r 比] [-a 追従の速さ] [-m 最小のパワー] 録音.wav...
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <chrono>
+#include <vector>
+
+#include "ToneDetector.hpp"
+
+/* MicTrigger::FRAME_SIZEと合わせること */
+static const std::size_t FRAME_SIZE = 256;
+/* MicTrigger.cppのCOIN_FREQUENCIESと合わせること */
+static const std::array<float, 3> COIN_FREQUENCIES = {3000.0f, 4500.0f,
+                                                      6000.0f};
+
+/*
+ * WAVファイルの内容
+ */
+struct wav_data_t
+{
+    uint32_t sampleRate;
+    std::vector<int16_t> samples;
+};
+
+/*
+ * 16bit PCMのWAVファイルを読み込みます。
+ *
+ * @param filename ファイル名
+ * @param wav 読み込んだ内容
+ * @retval true 読み込めた
+ * @retval false 読み込めなかった
+ */
+static bool readWav(const char* filename, wav_data_t& wav) {
+    FILE* file = fopen(filename, "rb");
+    if (file == nullptr) {
+        fprintf(stderr, "%s: Failed to open\n", filename);
+        return false;
+    }
+    char riff[12];
+    if (fread(riff, 1, sizeof(riff), file) != sizeof(riff) ||
+        memcmp(riff, "RIFF", 4) != 0 || memcmp(riff + 8, "WAVE", 4) != 0) {
+        fprintf(stderr, "%s: Not a WAV file\n", filename);
+        fclose(file);
+        return false;
+    }
+    uint16_t format = 0;
+    uint16_t channels = 0;
+    uint16_t bits = 0;
+    bool found = false;
+    char id[4];
+    uint32_t size;
+    while (fread(id, 1, 4, file) == 4 && fread(&size, 4, 1, file) == 1) {
+        if (memcmp(id, "fmt ", 4) == 0 && size >= 16) {
+            uint8_t fmt[16];
+            if (fread(fmt, 1, sizeof(fmt), file) != sizeof(fmt)) {
+                break;
+            }
+            memcpy(&format, fmt, 2);
+            memcpy(&channels, fmt + 2, 2);
+            memcpy(&wav.sampleRate, fmt + 4, 4);
+            memcpy(&bits, fmt + 14, 2);
+            fseek(file, size - sizeof(fmt) + (size & 1), SEEK_CUR);
+        } else if (memcmp(id, "data", 4) == 0) {
+            if (format != 1 || bits != 16 || channels == 0) {
+                fprintf(stderr, "%s: Unsupported format %d (%dbit, %dch)\n",
+                        filename, format, bits, channels);
+                break;
+            }
+            std::vector<int16_t> raw(size / 2);
+            raw.resize(fread(raw.data(), 2, raw.size(), file));
+            wav.samples.resize(raw.size() / channels);
+            for (std::size_t i = 0; i < wav.samples.size(); ++i) {
+                int32_t sum = 0;
+                for (uint16_t c = 0; c < channels; ++c) {
+                    sum += raw[i * channels + c];
+                }
+                wav.samples[i] = static_cast<int16_t>(sum / channels);
+            }
+            found = true;
+            break;
+        } else {
+            fseek(file, size + (size & 1), SEEK_CUR);
+        }
+    }
+    fclose(file);
+    if (!found) {
+        fprintf(stderr, "%s: No PCM data\n", filename);
+    }
+    return found;
+}
+
+int main(int argc, char* argv[]) {
+    float ratio = ToneDetector<>::DEFAULT_RATIO;
+    float adaptation = ToneDetector<>::DEFAULT_ADAPTATION;
+    float minPower = ToneDetector<>::DEFAULT_MIN_POWER;
+    int opt;
+    while ((opt = getopt(argc, argv, "r:a:m:")) != -1) {
+        switch (opt) {
+            case 'r':
+                ratio = atof(optarg);
+                break;
+            case 'a':
+                adaptation = atof(optarg);
+                break;
+            case 'm':
+                minPower = atof(optarg);
+                break;
+            default:
+                optind = argc;
+                break;
+        }
+    }
+    if (optind >= argc) {
+        fprintf(stderr,
+                "Usage: %s [-r ratio] [-a adaptation] [-m min_power] "
+                "file.wav...\n",
+                argv[0]);
+        return 1;
+    }
+
+    int status = 0;
+    printf("file,time_ms,power,noise_floor\n");
+    for (int f = optind; f < argc; ++f) {
+        wav_data_t wav;
+        if (!readWav(argv[f], wav)) {
+            status = 1;
+            continue;
+        }
+        ToneDetector<> detector(wav.sampleRate, COIN_FREQUENCIES, ratio,
+                                adaptation, minPower);
+        const std::size_t frames = wav.samples.size() / FRAME_SIZE;
+        std::size_t detections = 0;
+        std::chrono::nanoseconds busy(0);
+        for (std::size_t i = 0; i < frames; ++i) {
+            const int16_t* frame = wav.samples.data() + i * FRAME_SIZE;
+            const auto start = std::chrono::steady_clock::now();
+            const bool onset = detector.process(frame, FRAME_SIZE);
+            busy += std::chrono::steady_clock::now() - start;
+            if (onset) {
+                ++detections;
+                printf("%s,%.1f,%.3e,%.3e\n", argv[f],
+                       i * FRAME_SIZE * 1000.0 / wav.sampleRate,
+                       detector.getPower(), detector.getNoiseFloor());
+            }
+        }
+        const double samples = static_cast<double>(frames) * FRAME_SIZE;
+        const double seconds = samples / wav.sampleRate;
+        const double busyNs = static_cast<double>(busy.count());
+        fprintf(stderr,
+                "%s: %zu detections in %.1fs, %.1fns/sample (%.0fx "
+                "realtime)\n",
+                argv[f], detections, seconds,
+                samples > 0 ? busyNs / samples : 0.0,
+                busyNs > 0 ? seconds * 1e9 / busyNs : 0.0);
+    }
+    return status;
+}
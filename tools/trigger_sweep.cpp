@@ -0,0 +1,236 @@
+/*
+ * DistanceTriggerのパラメータを合成データで評価するツール
+ *
+ * 測定時間，マージン，不応期，校正回数の組み合わせごとに
+ * SyntheticToFUnitで模擬した数時間分の測定を行い，見逃し率，誤発火の回数，
+ * 検出までの遅れ（平均・99パーセンタイル）をCSVで出力します。
+ * 組み合わせはPCのすべてのコアで並列に評価します。
+ *
+ * ビルド（リポジトリのルートで）:
+ *   g++ -std=gnu++11 -O2 -pthread -Itools/host -Isrc -Itools \
+ *       tools/trigger_sweep.cpp -o trigger_sweep
+ *
+ * 使い方:
+ *   ./trigger_sweep [-h 時間] [-s 乱数の種] [-j スレッド数]
+ *                   [-n ノイズの大きさ] > sweep.csv
+ */
+#include <Arduino.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <thread>
+#include <vector>
+
+#include "DistanceTrigger.hpp"
+#include "SyntheticToFUnit.hpp"
+
+/*
+ * 評価するパラメータの組み合わせ
+ */
+struct sweep_config_t
+{
+    uint32_t timingBudget;
+    double margin;
+    uint32_t refractoryPeriod;
+    uint8_t calibrationCount;
+};
+
+/*
+ * 評価結果
+ */
+struct sweep_result_t
+{
+    sweep_config_t config;
+    std::size_t coins;
+    std::size_t missed;
+    std::size_t falseFires;
+    double meanLatencyMs;
+    double p99LatencyMs;
+    double hours;
+};
+
+static const uint32_t TIMING_BUDGETS[] = {20000, 33000, 50000, 100000, 200000};
+static const double MARGINS[] = {0.02, 0.03, 0.05, 0.08};
+static const uint32_t REFRACTORY_PERIODS[] = {0, 200, 500};
+static const uint8_t CALIBRATION_COUNTS[] = {5, 10, 20};
+
+/* 測定の間隔（loop()のdelay(1)に相当，マイクロ秒） */
+static const uint64_t LOOP_INTERVAL_US = 1000;
+/* 校正が終わってから最初のお賽銭までの時間（マイクロ秒） */
+static const uint64_t SETTLE_US = 1000000;
+
+static synthetic_profile_t profile = {
+    150.0,  // baseline
+    0.15,   // noiseScale
+    0.001,  // outOfRangeRate
+    0.0005, // timeoutRate
+    2.0,    // driftPerHour
+    30.0,   // coinsPerHour
+    5.0,    // coinDurationMinMs
+    30.0,   // coinDurationMaxMs
+    0.3,    // coinDepthMin
+    0.8,    // coinDepthMax
+};
+
+/*
+ * 1つの組み合わせを評価します。
+ *
+ * @param config パラメータの組み合わせ
+ * @param hours シミュレーションする時間
+ * @param seed 乱数の種
+ * @return 評価結果
+ */
+static sweep_result_t evaluate(const sweep_config_t& config, double hours,
+                               uint32_t seed) {
+    simClock() = 0;
+    SyntheticToFUnit* unit = new SyntheticToFUnit(profile, seed);
+    DistanceTrigger<distance_unit_t> trigger(unit);
+    trigger.setTimingBudget(config.timingBudget);
+    trigger.setMargin(config.margin);
+    trigger.setRefractoryPeriod(config.refractoryPeriod);
+    const distance_unit_t threshold =
+        trigger.calibrate(config.calibrationCount);
+    trigger.begin(threshold);
+    trigger.enable();
+
+    const uint64_t start = simClock() + SETTLE_US;
+    const uint64_t end = start + static_cast<uint64_t>(hours * 3600e6);
+    unit->schedule(start, end);
+    const std::vector<synthetic_coin_t>& coins = unit->getCoins();
+
+    std::vector<bool> detected(coins.size(), false);
+    std::vector<double> latencies;
+    std::size_t falseFires = 0;
+    std::size_t next = 0;
+    while (simClock() < end) {
+        if (trigger.isTriggered()) {
+            const uint64_t now = simClock();
+            // 測定時間1回分までの遅れはそのお賽銭の検出とみなす
+            while (next < coins.size() && coins[next].start +
+                                                  coins[next].duration +
+                                                  config.timingBudget <
+                                              now) {
+                ++next;
+            }
+            if (next < coins.size() && coins[next].start <= now &&
+                !detected[next]) {
+                detected[next] = true;
+                latencies.push_back((now - coins[next].start) / 1000.0);
+            } else {
+                ++falseFires;
+            }
+        }
+        simAdvance(LOOP_INTERVAL_US);
+    }
+
+    sweep_result_t result;
+    result.config = config;
+    result.coins = coins.size();
+    result.missed = std::count(detected.begin(), detected.end(), false);
+    result.falseFires = falseFires;
+    result.hours = hours;
+    result.meanLatencyMs = 0.0;
+    result.p99LatencyMs = 0.0;
+    if (!latencies.empty()) {
+        double sum = 0.0;
+        for (double l : latencies) {
+            sum += l;
+        }
+        result.meanLatencyMs = sum / latencies.size();
+        std::sort(latencies.begin(), latencies.end());
+        result.p99LatencyMs = latencies[(latencies.size() - 1) * 99 / 100];
+    }
+    return result;
+}
+
+int main(int argc, char* argv[]) {
+    double hours = 4.0;
+    uint32_t seed = 1;
+    unsigned threads = std::thread::hardware_concurrency();
+    int opt;
+    while ((opt = getopt(argc, argv, "h:s:j:n:")) != -1) {
+        switch (opt) {
+            case 'h':
+                hours = atof(optarg);
+                break;
+            case 's':
+                seed = strtoul(optarg, nullptr, 10);
+                break;
+            case 'j':
+                threads = strtoul(optarg, nullptr, 10);
+                break;
+            case 'n':
+                profile.noiseScale = atof(optarg);
+                break;
+            default:
+                fprintf(stderr,
+                        "Usage: %s [-h hours] [-s seed] [-j threads] "
+                        "[-n noise]\n",
+                        argv[0]);
+                return 1;
+        }
+    }
+    if (threads == 0) {
+        threads = 1;
+    }
+
+    std::vector<sweep_config_t> configs;
+    for (uint32_t budget : TIMING_BUDGETS) {
+        for (double margin : MARGINS) {
+            for (uint32_t refractory : REFRACTORY_PERIODS) {
+                for (uint8_t count : CALIBRATION_COUNTS) {
+                    configs.push_back({budget, margin, refractory, count});
+                }
+            }
+        }
+    }
+
+    // すべての組み合わせで同じお賽銭のイベント列を使うため，種は共通にする
+    std::vector<sweep_result_t> results(configs.size());
+    std::atomic<std::size_t> index(0);
+    std::vector<std::thread> workers;
+    for (unsigned t = 0; t < threads; ++t) {
+        workers.emplace_back([&]() {
+            std::size_t i;
+            while ((i = index++) < configs.size()) {
+                results[i] = evaluate(configs[i], hours, seed);
+            }
+        });
+    }
+    for (std::thread& w : workers) {
+        w.join();
+    }
+
+    printf(
+        "timing_budget_us,margin,refractory_ms,calibration_count,coins,"
+        "miss_rate,false_fires_per_hour,mean_latency_ms,p99_latency_ms\n");
+    const sweep_result_t* best = nullptr;
+    double bestScore = 0.0;
+    for (const sweep_result_t& r : results) {
+        const double missRate =
+            r.coins == 0 ? 0.0 : static_cast<double>(r.missed) / r.coins;
+        const double falseRate = r.falseFires / r.hours;
+        printf("%u,%.2f,%u,%u,%zu,%.4f,%.2f,%.1f,%.1f\n",
+               r.config.timingBudget, r.config.margin,
+               r.config.refractoryPeriod, r.config.calibrationCount, r.coins,
+               missRate, falseRate, r.meanLatencyMs, r.p99LatencyMs);
+        // 見逃し1%と1時間あたり1回の誤発火を同じ重みとし，遅れで順位をつける
+        const double score =
+            missRate * 100.0 + falseRate + r.p99LatencyMs / 1000.0;
+        if (best == nullptr || score < bestScore) {
+            best = &r;
+            bestScore = score;
+        }
+    }
+    if (best != nullptr) {
+        fprintf(stderr,
+                "Best: timing budget %uus, margin %.2f, refractory %ums, "
+                "calibration count %u\n",
+                best->config.timingBudget, best->config.margin,
+                best->config.refractoryPeriod, best->config.calibrationCount);
+    }
+    return 0;
+}